@@ -0,0 +1,515 @@
+/**
+ * DOC: xf-bench.c
+ * Host tool timing the allocators and tables against what they replace.
+ *
+ * DOC: README
+ *	cc -O2 -pthread xf-bench.c -o xf-bench
+ *	xf-bench [NAME...]
+ *
+ * Runs the benchmarks named on the command line, or all of them, each
+ * printing a line per configuration. The numbers are only comparable
+ * between runs on the same machine.
+ *
+ *	alloc	ns per xf_mregion_alloc() as the subregions pile up
+ *	atomic	allocations per second from one region shared by 1 to 32
+ *		threads, xf_mregion_alloc_atomic() against a mutex
+ *	pool	small object churn through xf_pool, xf_pool_cache and malloc
+ *	hash	GB/s of the hash functions over keys of 8 bytes to 32 KiB
+ *	find	lookups per second in a table well beyond the last level
+ *		cache, xf_htable_find() against xf_htable_find_many()
+ *	ftable	inserts and lookups per second in a table well beyond the last
+ *		level cache, xf_ftable against xf_htable
+ *	addmany	keys per second filling a table with xf_htable_add() and with
+ *		xf_htable_add_many(), and the time of small batches
+ *	sync	operations per second on one table shared by 1 to 32 threads
+ *		at 95% lookups, xf_htable_sync against a mutex
+ */
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE /* MAP_ANONYMOUS madvise for XF_MREGION_MMAP */
+
+#include "xf-mregion.h"
+#include "xf-pool.h"
+#include "xf-htable.h"
+#include "xf-ftable.h"
+
+#include <stdio.h> // printf
+#include <stdlib.h> // malloc free
+#include <string.h> // strcmp
+#include <time.h> // clock_gettime
+#include <pthread.h> // pthread_create pthread_join pthread_mutex_*
+
+/* seconds on a monotonic clock */
+static double bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* keeps the compiler from dropping the work being timed */
+static volatile size_t bench_sink;
+
+/*
+ * Fills regions of 4 KiB subregions until they hold 10 to 100000
+ * subregions, the cost per allocation should not depend on how many.
+ */
+static void bench_alloc(void)
+{
+	const struct xf_mregion_grow g = { 100, 4096, 4096 };
+	size_t subs, i;
+
+	for (subs = 10; subs <= 100000; subs *= 10) {
+		size_t n = subs * (4096 / 32);
+		struct xf_mregion *r = xf_mregion_create_grow(4096, &g);
+		double t = bench_now();
+		for (i = 0; i < n; i++)
+			bench_sink += (size_t) xf_mregion_alloc(r, 32);
+		t = bench_now() - t;
+		printf("alloc\t%6zu subregions\t%.2f ns/alloc\n", subs,
+				t * 1e9 / n);
+		xf_mregion_destroy(r);
+	}
+}
+
+/* a region shared by the threads of bench_atomic() */
+struct bench_shared {
+	struct xf_mregion *r;
+	pthread_mutex_t lock;
+	size_t n;
+	int locked;
+};
+
+static void *bench_atomic_thread(void *arg)
+{
+	struct bench_shared *sh = arg;
+	size_t i;
+
+	for (i = 0; i < sh->n; i++) {
+		if (sh->locked) {
+			pthread_mutex_lock(&sh->lock);
+			bench_sink += (size_t) xf_mregion_alloc(sh->r, 32);
+			pthread_mutex_unlock(&sh->lock);
+		} else {
+			bench_sink += (size_t) xf_mregion_alloc_atomic(sh->r,
+					32);
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Each of 1 to 32 threads makes 1M 32 byte allocations from one region,
+ * lock-free and under a mutex; scaling needs at least as many cores.
+ */
+static void bench_atomic(void)
+{
+	const struct xf_mregion_grow g = { 200, 1 << 16, 1 << 24 };
+	pthread_t th[32];
+	int nth, i, locked;
+
+	for (nth = 1; nth <= 32; nth *= 2) {
+		for (locked = 0; locked < 2; locked++) {
+			struct bench_shared sh = { NULL,
+				PTHREAD_MUTEX_INITIALIZER, 1000000, locked };
+			sh.r = xf_mregion_create_grow(1 << 16, &g);
+			double t = bench_now();
+			for (i = 0; i < nth; i++)
+				pthread_create(&th[i], NULL,
+						bench_atomic_thread, &sh);
+			for (i = 0; i < nth; i++)
+				pthread_join(th[i], NULL);
+			t = bench_now() - t;
+			printf("atomic\t%2d threads %s\t%.1f Mallocs/s\n", nth,
+					locked ? "mutex" : "atomic",
+					sh.n * nth / t / 1e6);
+			xf_mregion_destroy(sh.r);
+		}
+	}
+}
+
+/* xorshift64, the same sequence for every allocator being compared */
+static uint64_t bench_rand(uint64_t *x)
+{
+	*x ^= *x << 13;
+	*x ^= *x >> 7;
+	*x ^= *x << 17;
+	return *x;
+}
+
+/*
+ * Keeps 64K objects of 16 to 184 bytes alive and replaces a random one
+ * with a new object of random size 10M times: malloc() and free(), the
+ * pool directly and through a per-thread cache.
+ */
+static void bench_pool(void)
+{
+	enum { live = 1 << 16, ops = 10000000 };
+	void **obj = calloc(live, sizeof(*obj));
+	size_t *size = calloc(live, sizeof(*size));
+	const char *name[] = { "malloc", "xf_pool", "xf_pool_cache" };
+	int how;
+
+	for (how = 0; how < 3; how++) {
+		struct xf_pool p;
+		struct xf_pool_cache c;
+		uint64_t x = 88172645463325252ull;
+		size_t i;
+
+		xf_pool_construct(&p);
+		xf_pool_cache_construct(&c, &p);
+		memset(obj, 0, live * sizeof(*obj));
+		double t = bench_now();
+		for (i = 0; i < ops; i++) {
+			uint64_t rnd = bench_rand(&x);
+			size_t k = rnd % live, sz = 16 + (rnd >> 32) % 169;
+			if (obj[k] != NULL) {
+				if (how == 0)
+					free(obj[k]);
+				else if (how == 1)
+					xf_pool_free(&p, obj[k], size[k]);
+				else
+					xf_pool_cache_free(&c, obj[k],
+							size[k]);
+			}
+			obj[k] = how == 0 ? malloc(sz) : how == 1
+				? xf_pool_alloc(&p, sz)
+				: xf_pool_cache_alloc(&c, sz);
+			size[k] = sz;
+			*(char *) obj[k] = 1;
+		}
+		t = bench_now() - t;
+		printf("pool\t%-13s\t%.1f ns/op\n", name[how], t * 1e9 / ops);
+		if (how == 0)
+			for (i = 0; i < live; i++)
+				free(obj[i]);
+		xf_pool_cache_destruct(&c);
+		xf_pool_destruct(&p);
+	}
+	free(obj);
+	free(size);
+}
+
+/* xf_hash_wy64() with the signature of the 32-bit hashes */
+static uint32_t bench_wy64(const char *key, int len)
+{
+	return (uint32_t) xf_hash_wy64(key, len, 0);
+}
+
+/*
+ * Hashes 256 MiB worth of keys of each length with each function, the
+ * keys being consecutive slices of a buffer that fits in L2.
+ */
+static void bench_hash(void)
+{
+	static const struct {
+		const char *name;
+		uint32_t (*fn)(const char *, int);
+	} fns[] = {
+		{ "jenkins_oaat", xf_hash_jenkins_oaat },
+		{ "hsieh_superfast", xf_hash_hsieh_superfast },
+		{ "wy32", xf_hash_wy32 },
+		{ "wy64", bench_wy64 },
+	};
+	enum { buflen = 1 << 17, total = 1 << 28 };
+	char *buf = malloc(buflen);
+	size_t len, f, i;
+
+	for (i = 0; i < buflen; i++)
+		buf[i] = (char) (i * 131 + (i >> 8));
+	for (len = 8; len <= 65536; len *= 8) {
+		for (f = 0; f < sizeof(fns) / sizeof(fns[0]); f++) {
+			size_t n = total / len, at = 0;
+			uint32_t h = 0;
+			double t = bench_now();
+			for (i = 0; i < n; i++) {
+				h += fns[f].fn(buf + at, len);
+				at = (at + len + 1) & (buflen / 2 - 1);
+			}
+			t = bench_now() - t;
+			bench_sink += h;
+			printf("hash\t%5zu bytes %-15s\t%.2f GB/s\n", len,
+					fns[f].name, (double) total / t / 1e9);
+		}
+	}
+	free(buf);
+}
+
+/* the 8 byte key number @i, spread so that neighbours aren't related */
+static uint64_t bench_key(uint64_t i)
+{
+	return i * 0x9e3779b97f4a7c15ull;
+}
+
+/*
+ * Fills a table with 16M 8 byte keys, several hundred MiB, then looks up 4M
+ * random ones of them one at a time and in batches of 512.
+ */
+static void bench_find(void)
+{
+	enum { n = 1 << 24, lookups = 1 << 22, batch = 512 };
+	struct xf_htable t;
+	uint64_t *keys = malloc(lookups * sizeof(*keys));
+	const void **kp = malloc(batch * sizeof(*kp));
+	size_t *lens = malloc(batch * sizeof(*lens));
+	void **vals = malloc(batch * sizeof(*vals));
+	uint64_t i, k, x = 88172645463325252ull;
+	size_t found;
+
+	xf_htable_construct(&t, 4, sizeof(uint64_t), xf_hash_wy32);
+	for (i = 0; i < n; i++) {
+		k = bench_key(i);
+		xf_htable_add(&t, &k, sizeof(k), &i);
+	}
+	for (i = 0; i < lookups; i++)
+		keys[i] = bench_key(bench_rand(&x) % n);
+	for (i = 0; i < batch; i++)
+		lens[i] = sizeof(uint64_t);
+
+	double t1 = bench_now();
+	for (i = 0, found = 0; i < lookups; i++)
+		found += xf_htable_find(&t, &keys[i], sizeof(keys[i])) != NULL;
+	t1 = bench_now() - t1;
+	double t2 = bench_now();
+	for (i = 0; i < lookups; i += batch) {
+		for (k = 0; k < batch; k++)
+			kp[k] = &keys[i + k];
+		found += xf_htable_find_many(&t, batch, kp, lens, vals);
+	}
+	t2 = bench_now() - t2;
+	bench_sink += found;
+	printf("find\t%d keys in %zu MiB\n", n, xf_htable_memcnt(&t) >> 20);
+	printf("find\t%d keys xf_htable_find\t%.2f Mlookups/s\n", n,
+			lookups / t1 / 1e6);
+	printf("find\t%d keys xf_htable_find_many\t%.2f Mlookups/s\n", n,
+			lookups / t2 / 1e6);
+	xf_htable_destruct(&t);
+	free(keys);
+	free(kp);
+	free(lens);
+	free(vals);
+}
+
+/*
+ * Fills an xf_htable and then an xf_ftable with 8M 8 byte keys, a few
+ * hundred MiB each, and looks up 4M random ones of them in each.
+ */
+static void bench_ftable(void)
+{
+	enum { n = 1 << 23, lookups = 1 << 22 };
+	struct xf_htable h;
+	struct xf_ftable f;
+	uint64_t *keys = malloc(lookups * sizeof(*keys));
+	uint64_t i, k, x = 88172645463325252ull;
+	size_t found = 0, mem;
+
+	for (i = 0; i < lookups; i++)
+		keys[i] = bench_key(bench_rand(&x) % n);
+
+	double t1 = bench_now();
+	xf_htable_construct(&h, 4, sizeof(uint64_t), xf_hash_wy32);
+	for (i = 0; i < n; i++) {
+		k = bench_key(i);
+		xf_htable_add(&h, &k, sizeof(k), &i);
+	}
+	t1 = bench_now() - t1;
+	double t2 = bench_now();
+	for (i = 0; i < lookups; i++)
+		found += xf_htable_find(&h, &keys[i], sizeof(keys[i])) != NULL;
+	t2 = bench_now() - t2;
+	mem = xf_htable_memcnt(&h);
+	xf_htable_destruct(&h);
+	printf("ftable\t%d keys xf_htable in %zu MiB\t%.2f Minserts/s"
+			"\t%.2f Mlookups/s\n", n, mem >> 20, n / t1 / 1e6,
+			lookups / t2 / 1e6);
+
+	t1 = bench_now();
+	xf_ftable_construct(&f, 4, sizeof(uint64_t), xf_hash_wy32);
+	for (i = 0; i < n; i++) {
+		k = bench_key(i);
+		xf_ftable_add(&f, &k, sizeof(k), &i);
+	}
+	t1 = bench_now() - t1;
+	t2 = bench_now();
+	for (i = 0; i < lookups; i++)
+		found += xf_ftable_find(&f, &keys[i], sizeof(keys[i])) != NULL;
+	t2 = bench_now() - t2;
+	mem = xf_ftable_memcnt(&f);
+	xf_ftable_destruct(&f);
+	printf("ftable\t%d keys xf_ftable in %zu MiB\t%.2f Minserts/s"
+			"\t%.2f Mlookups/s\n", n, mem >> 20, n / t1 / 1e6,
+			lookups / t2 / 1e6);
+	bench_sink += found;
+	free(keys);
+}
+
+/*
+ * Fills a table with close to 2M 8 byte keys one at a time and in one
+ * batch, then adds 1000 batches of 10 more keys to the full one, taking it
+ * up to its load limit without growing.
+ */
+static void bench_addmany(void)
+{
+	enum { total = 1 << 21, small = 10, rounds = 1000 };
+	enum { n = total - small * rounds };
+	struct xf_htable t;
+	uint64_t *keys = malloc(total * sizeof(*keys));
+	const void **kp = malloc(total * sizeof(*kp));
+	size_t *lens = malloc(total * sizeof(*lens));
+	size_t added = 0, i;
+
+	for (i = 0; i < total; i++) {
+		keys[i] = bench_key(i);
+		kp[i] = &keys[i];
+		lens[i] = sizeof(keys[i]);
+	}
+
+	double t1 = bench_now();
+	xf_htable_construct(&t, 4, sizeof(uint64_t), xf_hash_wy32);
+	for (i = 0; i < n; i++)
+		added += xf_htable_add(&t, kp[i], lens[i], &keys[i])
+			== XF_HTABLE_ESUCCESS;
+	t1 = bench_now() - t1;
+	xf_htable_destruct(&t);
+	double t2 = bench_now();
+	xf_htable_construct(&t, 4, sizeof(uint64_t), xf_hash_wy32);
+	added += xf_htable_add_many(&t, n, kp, lens, keys);
+	t2 = bench_now() - t2;
+	double t3 = bench_now();
+	for (i = n; i < total; i += small)
+		added += xf_htable_add_many(&t, small, kp + i, lens + i,
+				keys + i);
+	t3 = bench_now() - t3;
+	bench_sink += added;
+	printf("addmany\t%d keys xf_htable_add\t%.2f Mkeys/s\n", n,
+			n / t1 / 1e6);
+	printf("addmany\t%d keys xf_htable_add_many\t%.2f Mkeys/s\n", n,
+			n / t2 / 1e6);
+	printf("addmany\t%d keys per call, %u buckets\t%.2f us/call\n",
+			small, t.res_mask + 1, t3 / rounds * 1e6);
+	xf_htable_destruct(&t);
+	free(keys);
+	free(kp);
+	free(lens);
+}
+
+/* a table shared by the threads of bench_sync() */
+struct bench_table {
+	struct xf_htable_sync s;
+	pthread_mutex_t lock;
+	uint64_t seed;
+	size_t keys, ops;
+	int locked;
+};
+
+static void *bench_sync_thread(void *arg)
+{
+	struct bench_table *bt = arg;
+	uint64_t x = __atomic_add_fetch(&bt->seed, 0x9e3779b97f4a7c15ull,
+			__ATOMIC_RELAXED);
+	uint64_t k, v;
+	size_t i, found = 0;
+
+	for (i = 0; i < bt->ops; i++) {
+		uint64_t rnd = bench_rand(&x);
+		k = bench_key(rnd % bt->keys);
+		int write = (rnd >> 40) % 100 < 5;
+		if (bt->locked) {
+			pthread_mutex_lock(&bt->lock);
+			if (write) /* like xf_htable_sync_set() */
+				memcpy(xf_htable_see(&bt->s.t, &k, sizeof(k),
+							&rnd), &rnd,
+						sizeof(rnd));
+			else
+				found += xf_htable_find(&bt->s.t, &k,
+						sizeof(k)) != NULL;
+			pthread_mutex_unlock(&bt->lock);
+		} else if (write) {
+			xf_htable_sync_set(&bt->s, &k, sizeof(k), &rnd);
+		} else {
+			found += !xf_htable_sync_find(&bt->s, &k, sizeof(k),
+					&v);
+		}
+	}
+	bench_sink += found;
+	return NULL;
+}
+
+/*
+ * 1 to 32 threads each make 1M operations on a table of 1M keys, 5% of
+ * them writes; scaling needs at least as many cores.
+ */
+static void bench_sync(void)
+{
+	pthread_t th[32];
+	int nth, i, locked;
+	uint64_t k;
+
+	for (nth = 1; nth <= 32; nth *= 2) {
+		for (locked = 0; locked < 2; locked++) {
+			struct bench_table bt;
+			bt.seed = 1;
+			bt.keys = 1 << 20;
+			bt.ops = 1000000;
+			bt.locked = locked;
+			pthread_mutex_init(&bt.lock, NULL);
+			xf_htable_sync_construct(&bt.s, 20, sizeof(uint64_t),
+					xf_hash_wy32);
+			for (k = 0; k < bt.keys; k++) {
+				uint64_t key = bench_key(k);
+				xf_htable_sync_add(&bt.s, &key, sizeof(key),
+						&k);
+			}
+			double t = bench_now();
+			for (i = 0; i < nth; i++)
+				pthread_create(&th[i], NULL, bench_sync_thread,
+						&bt);
+			for (i = 0; i < nth; i++)
+				pthread_join(th[i], NULL);
+			t = bench_now() - t;
+			printf("sync\t%2d threads %s\t%.2f Mops/s\n", nth,
+					locked ? "mutex" : "sync",
+					bt.ops * nth / t / 1e6);
+			xf_htable_sync_destruct(&bt.s);
+			pthread_mutex_destroy(&bt.lock);
+		}
+	}
+}
+
+static const struct {
+	const char *name;
+	void (*run)(void);
+} benches[] = {
+	{ "alloc", bench_alloc },
+	{ "atomic", bench_atomic },
+	{ "pool", bench_pool },
+	{ "hash", bench_hash },
+	{ "find", bench_find },
+	{ "ftable", bench_ftable },
+	{ "addmany", bench_addmany },
+	{ "sync", bench_sync },
+};
+
+int main(int argc, char **argv)
+{
+	size_t i;
+	int a, rv = 0;
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		for (a = 1; a < argc; a++)
+			if (!strcmp(argv[a], benches[i].name))
+				break;
+		if (argc == 1 || a < argc)
+			benches[i].run();
+	}
+	for (a = 1; a < argc; a++) {
+		for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+			if (!strcmp(argv[a], benches[i].name))
+				break;
+		if (i == sizeof(benches) / sizeof(benches[0])) {
+			fprintf(stderr, "%s: no benchmark %s\n", argv[0],
+					argv[a]);
+			rv = 2;
+		}
+	}
+	return rv;
+}
@@ -0,0 +1,376 @@
+#if !defined(XFSTATIC) /* is .c processed first? */
+#define _XF_STATIC 0 /* avoid looping between .c and .h */
+#define _XF_MACROS 1
+#include "xf-ftable.h"
+#endif
+
+#include <stdlib.h> // malloc free
+#include <string.h> // memset memcpy memcmp
+#include <assert.h> // assert
+#ifdef __SSE2__
+#include <emmintrin.h> // _mm_*
+#endif
+
+#ifndef USHRT_MAX
+#define USHRT_MAX ((unsigned short)~((unsigned short)0))
+#endif
+
+/* control byte values, full slots hold the top 7 bits of the hash */
+#define XF_FTABLE_EMPTY		((uint8_t) 0x80)
+#define XF_FTABLE_DELETED	((uint8_t) 0xfe)
+
+#define XF_FTABLE_H2(hash) ((uint8_t) ((hash) >> 25))
+
+/**
+ * xf_ftable_match() - find the control bytes of a group equal to a value
+ * @g:		first control byte of the group
+ * @v:		value to look for
+ *
+ * Return:	bitmask where bit i is set if @g[i] equals @v
+ */
+static inline unsigned int xf_ftable_match(const uint8_t *g, uint8_t v)
+{
+#ifdef __SSE2__
+	__m128i ctrl = _mm_loadu_si128((const __m128i *) g);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(v)));
+#else
+	unsigned int i, m = 0;
+	for (i = 0; i < XF_FTABLE_GROUP; i++)
+		m |= (unsigned int) (g[i] == v) << i;
+	return m;
+#endif
+}
+
+/**
+ * xf_ftable_match_free() - find the empty or deleted slots of a group
+ * @g:		first control byte of the group
+ *
+ * Return:	bitmask where bit i is set if @g[i] is not a full slot
+ */
+static inline unsigned int xf_ftable_match_free(const uint8_t *g)
+{
+#ifdef __SSE2__
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) g));
+#else
+	unsigned int i, m = 0;
+	for (i = 0; i < XF_FTABLE_GROUP; i++)
+		m |= (unsigned int) (g[i] >> 7) << i;
+	return m;
+#endif
+}
+
+/* index of the lowest set bit of nonzero @m */
+static inline unsigned int xf_ftable_lowbit(unsigned int m)
+{
+#if __GNUC__
+	return __builtin_ctz(m);
+#else
+	unsigned int i = 0;
+	while (!(m & 1)) {
+		m >>= 1;
+		i++;
+	}
+	return i;
+#endif
+}
+
+static inline union xf_htable_key *xf_ftable_slot(struct xf_ftable *t,
+		size_t i)
+{
+	return (union xf_htable_key *) (t->slots + i * t->slot_size);
+}
+
+static inline void *xf_ftable_slot_val(struct xf_ftable *t, size_t i)
+{
+	return t->slots + i * t->slot_size + sizeof(union xf_htable_key);
+}
+
+/* number of leading zeros of nonzero group bitmask @m */
+static inline unsigned int xf_ftable_leadzero(unsigned int m)
+{
+	unsigned int i = 0;
+	while (!(m & (1u << (XF_FTABLE_GROUP - 1)))) {
+		m <<= 1;
+		i++;
+	}
+	return i;
+}
+
+/**
+ * xf_ftable_set_ctrl() - set a control byte, keeping the copy at the end
+ * @t:		table
+ * @i:		slot index
+ * @v:		new value for the control byte
+ */
+static inline void xf_ftable_set_ctrl(struct xf_ftable *t, size_t i,
+		uint8_t v)
+{
+	t->ctrl[i] = v;
+	if (i < XF_FTABLE_GROUP)
+		t->ctrl[t->mask + 1 + i] = v;
+}
+
+/**
+ * xf_ftable_alloc() - allocate the arrays for given capacity
+ * @t:		table which's @ctrl and @slots to set, the old ones are not
+ *		freed
+ * @cap:	capacity, a power of two >= %XF_FTABLE_GROUP
+ */
+static void xf_ftable_alloc(struct xf_ftable *t, size_t cap)
+{
+	size_t cbytes = (cap + XF_FTABLE_GROUP + 15) & ~(size_t) 15;
+	t->ctrl = malloc(cbytes + cap * t->slot_size);
+	assert(t->ctrl != NULL);
+	memset(t->ctrl, XF_FTABLE_EMPTY, cap + XF_FTABLE_GROUP);
+	t->slots = (char *) t->ctrl + cbytes;
+	t->mask = cap - 1;
+	t->count = 0;
+	t->growth_left = cap - cap / 8;
+}
+
+/**
+ * xf_ftable_find_free() - find the slot a new entry for a hash goes to
+ * @t:		table with at least one empty slot
+ * @hash:	hash of the key
+ *
+ * Return:	index of the first empty or deleted slot on the probe sequence
+ */
+static size_t xf_ftable_find_free(struct xf_ftable *t, uint32_t hash)
+{
+	size_t pos = hash & t->mask;
+	size_t step = 0;
+	unsigned int m;
+
+	while (!(m = xf_ftable_match_free(t->ctrl + pos))) {
+		step += XF_FTABLE_GROUP;
+		pos = (pos + step) & t->mask;
+	}
+	return (pos + xf_ftable_lowbit(m)) & t->mask;
+}
+
+/**
+ * xf_ftable_rehash() - move all of the entries into arrays of new capacity
+ * @t:		table
+ * @cap:	the new capacity
+ *
+ * This also gets rid of the deleted slots.
+ */
+static void xf_ftable_rehash(struct xf_ftable *t, size_t cap)
+{
+	uint8_t *octrl = t->ctrl;
+	char *oslots = t->slots;
+	size_t i, ocap = t->mask + 1, count = t->count;
+
+	xf_ftable_alloc(t, cap);
+	for (i = 0; i < ocap; i++) {
+		if (octrl[i] & 0x80)
+			continue;
+		union xf_htable_key *k = (union xf_htable_key *)
+			(oslots + i * t->slot_size);
+		const void *kp = k->accesstyp == XF_HTABLE_KEY_DIRECT
+			? (const void *) k->direct.a : k->indirect.ptr;
+		size_t kl = k->accesstyp == XF_HTABLE_KEY_DIRECT
+			? k->direct.length : k->indirect.length;
+		uint32_t hash = t->hash(kp, kl);
+		size_t j = xf_ftable_find_free(t, hash);
+		xf_ftable_set_ctrl(t, j, XF_FTABLE_H2(hash));
+		memcpy(xf_ftable_slot(t, j), k, t->slot_size);
+	}
+	t->count = count;
+	t->growth_left -= count;
+	free(octrl);
+}
+
+/**
+ * xf_ftable_lookup() - find the slot of a key
+ * @t:		table
+ * @hash:	hash of @key
+ * @key:	key to look for
+ * @keylen:	length of @key
+ *
+ * Return:	index of the slot or -1 if not found
+ */
+static ptrdiff_t xf_ftable_lookup(struct xf_ftable *t, uint32_t hash,
+		const void *key, size_t keylen)
+{
+	size_t pos = hash & t->mask;
+	size_t step = 0;
+	uint8_t h2 = XF_FTABLE_H2(hash);
+
+	for (;;) {
+		const uint8_t *g = t->ctrl + pos;
+		unsigned int m = xf_ftable_match(g, h2);
+		while (m) {
+			size_t i = (pos + xf_ftable_lowbit(m)) & t->mask;
+			union xf_htable_key *k = xf_ftable_slot(t, i);
+			if (k->accesstyp == XF_HTABLE_KEY_DIRECT) {
+				if (k->direct.length == keylen
+						&& !memcmp(k->direct.a, key, keylen))
+					return i;
+			} else if (k->indirect.length == keylen
+					&& !memcmp(k->indirect.ptr, key, keylen)) {
+				return i;
+			}
+			m &= m - 1;
+		}
+		/* an empty slot ends the probe sequence */
+		if (xf_ftable_match(g, XF_FTABLE_EMPTY))
+			return -1;
+		step += XF_FTABLE_GROUP;
+		pos = (pos + step) & t->mask;
+	}
+}
+
+/**
+ * xf_ftable_get() - gets a slot for key/value pair
+ * @t:		table
+ * @key:	key to get the slot for
+ * @keylen:	length of @key
+ * @ri:		where to write the index of the slot
+ *
+ * Return:	1 if given key was already in the table and it was returned
+ *
+ *		2 if a new slot was taken for the key and returned
+ */
+static int xf_ftable_get(struct xf_ftable *t, const void *key, size_t keylen,
+		size_t *ri)
+{
+	assert(t != NULL && key != NULL && ri != NULL);
+	assert(keylen <= USHRT_MAX);
+	uint32_t hash = t->hash(key, keylen);
+	ptrdiff_t found = xf_ftable_lookup(t, hash, key, keylen);
+
+	if (found >= 0) {
+		*ri = found;
+		return 1;
+	}
+	size_t i = xf_ftable_find_free(t, hash);
+	if (t->growth_left == 0 && t->ctrl[i] != XF_FTABLE_DELETED) {
+		/* grow unless it's mostly deleted slots taking up room */
+		size_t cap = t->mask + 1;
+		xf_ftable_rehash(t, t->count * 2 >= cap - cap / 8 ? cap * 2 : cap);
+		i = xf_ftable_find_free(t, hash);
+	}
+	if (t->ctrl[i] == XF_FTABLE_EMPTY)
+		t->growth_left--;
+	xf_ftable_set_ctrl(t, i, XF_FTABLE_H2(hash));
+	t->count++;
+
+	union xf_htable_key *k = xf_ftable_slot(t, i);
+	memset(k, 0, sizeof(*k));
+	if (keylen <= XF_HTABLE_KEY_DIRECT_MAX) {
+		k->accesstyp = XF_HTABLE_KEY_DIRECT;
+		k->direct.length = keylen;
+		memcpy(k->direct.a, key, keylen);
+	} else {
+		k->accesstyp = XF_HTABLE_KEY_INDIRECT;
+		k->indirect.length = keylen;
+		k->indirect.ptr = key;
+	}
+	*ri = i;
+	return 2;
+}
+
+XFFNC void xf_ftable_construct(struct xf_ftable *t, unsigned int size_bits,
+		size_t value_size, uint32_t (*hash)(const char *,int))
+{
+	assert(t != NULL && hash != NULL);
+	size_t cap = (size_t) 1 << size_bits;
+	if (cap < XF_FTABLE_GROUP)
+		cap = XF_FTABLE_GROUP;
+	t->hash = hash;
+	t->value_size = value_size;
+	t->slot_size = (sizeof(union xf_htable_key) + value_size
+			+ sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	xf_ftable_alloc(t, cap);
+}
+
+XFFNC void xf_ftable_destruct(struct xf_ftable *t)
+{
+	free(t->ctrl);
+	t->ctrl = NULL;
+	t->slots = NULL;
+}
+
+XFFNC void xf_ftable_clear(struct xf_ftable *t)
+{
+	size_t cap = t->mask + 1;
+	memset(t->ctrl, XF_FTABLE_EMPTY, cap + XF_FTABLE_GROUP);
+	t->count = 0;
+	t->growth_left = cap - cap / 8;
+}
+
+XFFNC size_t xf_ftable_memcnt(struct xf_ftable *t)
+{
+	assert(t->ctrl != NULL);
+	size_t cap = t->mask + 1;
+	return ((cap + XF_FTABLE_GROUP + 15) & ~(size_t) 15)
+		+ cap * t->slot_size;
+}
+
+XFFNC int xf_ftable_add(struct xf_ftable *t, const void *key, size_t keylen,
+		const void *value_in)
+{
+	size_t i;
+	if (xf_ftable_get(t, key, keylen, &i) == 1)
+		return XF_HTABLE_ESET;
+	memcpy(xf_ftable_slot_val(t, i), value_in, t->value_size);
+	return XF_HTABLE_ESUCCESS;
+}
+
+XFFNC void *xf_ftable_see(struct xf_ftable *t, const void *key, size_t keylen,
+		const void *value_def)
+{
+	size_t i;
+	int gv = xf_ftable_get(t, key, keylen, &i);
+	void *val = xf_ftable_slot_val(t, i);
+	if (gv == 2) {
+		if (value_def == NULL)
+			memset(val, 0, t->value_size);
+		else
+			memcpy(val, value_def, t->value_size);
+	}
+	return val;
+}
+
+XFFNC void *xf_ftable_find(struct xf_ftable *t, const void *key, size_t keylen)
+{
+	ptrdiff_t i = xf_ftable_lookup(t, t->hash(key, keylen), key, keylen);
+	return i < 0 ? NULL : xf_ftable_slot_val(t, i);
+}
+
+XFFNC int xf_ftable_verify(struct xf_ftable *t, const void *key, size_t keylen,
+		const void *value)
+{
+	void *v = xf_ftable_find(t, key, keylen);
+	if (v == NULL) return XF_HTABLE_ENOTFOUND;
+	return !memcmp(value, v, t->value_size)
+		? XF_HTABLE_ESUCCESS : XF_HTABLE_ENOTEQUAL;
+}
+
+XFFNC int xf_ftable_remove(struct xf_ftable *t, const void *key,
+		size_t keylen)
+{
+	assert(t != NULL);
+	assert(key != NULL);
+	ptrdiff_t i = xf_ftable_lookup(t, t->hash(key, keylen), key, keylen);
+	if (i < 0)
+		return XF_HTABLE_ENOTFOUND;
+	/*
+	 * The slot can go back to being empty if no probe sequence could
+	 * have passed over it: the groups before and after it have an empty
+	 * slot that close.
+	 */
+	size_t before = (i - XF_FTABLE_GROUP) & t->mask;
+	unsigned int eb = xf_ftable_match(t->ctrl + before, XF_FTABLE_EMPTY);
+	unsigned int ea = xf_ftable_match(t->ctrl + i, XF_FTABLE_EMPTY);
+	if (eb && ea && xf_ftable_lowbit(ea) + xf_ftable_leadzero(eb)
+			< XF_FTABLE_GROUP) {
+		xf_ftable_set_ctrl(t, i, XF_FTABLE_EMPTY);
+		t->growth_left++;
+	} else {
+		xf_ftable_set_ctrl(t, i, XF_FTABLE_DELETED);
+	}
+	t->count--;
+	return XF_HTABLE_ESUCCESS;
+}
@@ -0,0 +1,195 @@
+/**
+ * DOC:	xf-ftable.h - a flat, open-addressing hash-table
+ * https://abseil.io/about/design/swisstables
+ *
+ * An alternative engine to xf-htable.h with the same interface: instead of
+ * a bucket array pointing to separately allocated buckets, keys and values
+ * live inline in a single array of slots. A parallel array holds one control
+ * byte per slot, which is either empty, deleted, or 7 bits of the key's hash.
+ * Lookups compare a whole group of 16 control bytes against the hash at once
+ * (with SSE2 where available) and only look at the slots that matched,
+ * which on a hit typically costs one cache miss for the control bytes and
+ * one for the slot.
+ *
+ * The table grows by itself once it is 7/8 full, so there is no %EFULL and
+ * the size_bits given to xf_ftable_construct() is only a starting point.
+ *
+ * "xf-bench ftable" times inserts and lookups in both engines on a table
+ * well beyond the last level cache.
+ *
+ * By convention, functions which report integer errors, return 0 on
+ * success. The error codes are the %XF_HTABLE_E* ones of xf-htable.h.
+ *
+ * Important note: like with xf-htable.h, keys are not copied!!
+ *
+ * To externally share these functions between units (as non-static), define
+ * %_XF_STATIC 0 before including the header and separately compile
+ * xf-ftable.c, xf-htable.c (for the hash functions) and xf-mregion.c.
+ */
+#ifndef _XF_FTABLE_H
+#define _XF_FTABLE_H 00,03,00
+
+#include "xf-htable.h"
+
+/* #define _XF_STATIC 0 to use these as external functions */
+#ifndef _XF_STATIC // Whether library should "#include" function bodies
+#define XFSTATIC 1
+#else
+#define XFSTATIC _XF_STATIC
+#endif
+
+#if __GNUC__ /* Suppress unused warnings */
+#define XFNOWRN __attribute__((unused))
+#else
+#define XFNOWRN
+#endif
+
+#ifdef _XF_FNC_DECLR /* The flags embedded in function declaration */
+#define XFFNC XFNOWRN _XF_FNC_DECLR
+#elif XFSTATIC == 1
+#define XFFNC XFNOWRN static
+#else
+#define XFFNC XFNOWRN
+#endif
+
+/* control bytes compared at once, also the smallest capacity */
+#define XF_FTABLE_GROUP 16
+
+/**
+ * struct xf_ftable - instance of flat hash-table
+ * @hash:	hash function used for distributing the data
+ * @value_size:	how many bytes does a single value take up
+ * @slot_size:	bytes per slot: a &union xf_htable_key followed by the value,
+ *		padded to keep the next slot aligned
+ * @mask:	capacity of the table minus one, the capacity being a power of
+ *		two of at least %XF_FTABLE_GROUP
+ * @count:	entries in the table
+ * @growth_left:	entries that can be added before the table is rehashed,
+ *		deleted slots count as taken until then
+ * @ctrl:	@mask + 1 control bytes followed by a copy of the first
+ *		%XF_FTABLE_GROUP of them, so that a group can be loaded at any
+ *		position without wrapping around
+ * @slots:	@mask + 1 slots of @slot_size bytes
+ */
+struct xf_ftable
+{
+	uint32_t (*hash)(const char *key, int len);
+	size_t value_size;
+	size_t slot_size;
+	size_t mask;
+	size_t count;
+	size_t growth_left;
+	uint8_t *ctrl;
+	char *slots;
+};
+
+/**
+ * xf_ftable_construct() - initialize an instance of struct xf_ftable
+ * @t:		instance to initialize
+ * @size_bits:	2^@size_bits = the initial capacity of the table, it is
+ *		raised to %XF_FTABLE_GROUP if less
+ * @value_size:	the byte-size of data you wish to associate with the keys
+ * @hash:	the hash function, one of xf_hash_* or your own; the top 7 bits
+ *		of the hash are used to tell keys apart in the control bytes,
+ *		so all 32 bits should be well mixed
+ */
+XFFNC void xf_ftable_construct(struct xf_ftable *t, unsigned int size_bits,
+		size_t value_size, uint32_t (*hash)(const char *,int));
+
+/**
+ * xf_ftable_memcnt() - count dynamically allocated memory associated with table
+ * @t:		table which's memory to count
+ *
+ * Return:	amount of memory malloc()'ed
+ */
+XFFNC size_t xf_ftable_memcnt(struct xf_ftable *t);
+
+/**
+ * xf_ftable_destruct() - releases all associated memory allocated to table
+ * @t:		the table no longer required
+ */
+XFFNC void xf_ftable_destruct(struct xf_ftable *t);
+
+/**
+ * xf_ftable_clear() - remove all entries but keep memory associated with table
+ * @t:		table to reset
+ */
+XFFNC void xf_ftable_clear(struct xf_ftable *t);
+
+/**
+ * xf_ftable_add() - add a key/value combination to the table
+ * @t:		the table to put the value/key in
+ * @key:	the key to associate the value with
+ * @keylen:	length of @key in bytes, at most %USHRT_MAX
+ * @value:	where to read the value associated with the key from -
+ *		@t->value_size bytes will be read and copied
+ *
+ * Return:	%XF_HTABLE_ESUCCESS on success and %XF_HTABLE_ESET if an entry
+ *		already exists
+ */
+XFFNC int xf_ftable_add(struct xf_ftable *t, const void *key, size_t keylen,
+		const void *value);
+
+/**
+ * xf_ftable_see() - see to that given key is in the table
+ * @t:		table to look in
+ * @key:	key to associate value with
+ * @keylen:	length of @key
+ * @value_def:	value to associate the key with if it's not in the table or
+ *		%NULL to memset() the value to null
+ *
+ * See xf_htable_see() about @key.
+ *
+ * Return:	pointer to the value in the table
+ */
+XFFNC void *xf_ftable_see(struct xf_ftable *t, const void *key, size_t keylen,
+		const void *value_def);
+
+/**
+ * xf_ftable_find() - looks up the value for given key
+ * @t:		table to look in
+ * @key:	key to search for
+ * @keylen:	length of the @key in bytes
+ *
+ * Return:	%NULL or a pointer to the value as it is in the slot, which
+ *		contents are safe to modify so long as xf_ftable_add(),
+ *		xf_ftable_see() and xf_ftable_remove() are not called.
+ */
+XFFNC void *xf_ftable_find(struct xf_ftable *t, const void *key, size_t keylen);
+
+/**
+ * xf_ftable_verify() - verify that a key/value pair exists in table
+ * @t:		table to look in
+ * @key:	key to search for
+ * @keylen:	length of @key
+ * @value:	the value to match
+ *
+ * Return:	same as xf_htable_verify()
+ */
+XFFNC int xf_ftable_verify(struct xf_ftable *t, const void *key, size_t keylen,
+		const void *value);
+
+/**
+ * xf_ftable_remove() - looks up the given key and removes it with its value
+ * @t:		table to look in
+ * @key:	key to search for
+ * @keylen:	length of the @key in bytes
+ *
+ * Return:	%XF_HTABLE_ESUCCESS on success, %XF_HTABLE_ENOTFOUND if key
+ *		wasn't found
+ */
+XFFNC int xf_ftable_remove(struct xf_ftable *t, const void *key,
+		size_t keylen);
+
+#if XFSTATIC == 1 // Include function bodies?
+#include "xf-ftable.c"
+#endif
+
+#if !defined(_XF_MACROS) || _XF_MACROS == 0
+// Clear up some internal «local» definitions
+#undef XFFNC
+#undef XFNOWRN
+#undef XFSTATIC
+#endif
+
+#endif
@@ -8,253 +8,1665 @@
 #include <string.h> // memset memcpy
 #include <assert.h> // assert
 
+#if XF_HTABLE_FILE
+#include <stdio.h> // fopen fwrite fclose
+#include <sys/mman.h> // mmap munmap
+#include <sys/stat.h> // fstat
+#include <fcntl.h> // open
+#include <unistd.h> // close
+#endif
+
 #ifndef USHRT_MAX
 #define USHRT_MAX ((unsigned short)~((unsigned short)0))
 #endif
 
+#if XF_HTABLE_COUNTERS
+#define XF_HTABLE_COUNT(expr) expr
+#else
+#define XF_HTABLE_COUNT(expr)
+#endif
+
 XFFNC void xf_htable_construct(struct xf_htable *t, unsigned int size_bits,
 		size_t value_size, uint32_t (*hash)(const char*,int))
 {
 	assert(size_bits <= 32);
-	t->res_mask = (1 << size_bits) - 1;
+	t->res_mask = ((size_t) 1 << size_bits) - 1;
 	t->hash = hash;
 	t->value_size = value_size;
-	t->buckets = calloc(1 << size_bits, sizeof(*t->buckets));
+	t->buckets = calloc((size_t) 1 << size_bits, sizeof(*t->buckets));
+	t->count = 0;
+	t->max_load = XF_HTABLE_MAXLOAD;
+	t->old_buckets = NULL;
+	t->old_mask = 0;
+	t->migrate = 0;
+	t->hash64 = NULL;
+	t->seed = 0;
+	t->keys = NULL;
+	t->dense = NULL;
+	XF_HTABLE_COUNT(memset(&t->counters, 0, sizeof(t->counters)));
+}
+
+XFFNC void xf_htable_construct64(struct xf_htable *t, unsigned int size_bits,
+		size_t value_size,
+		uint64_t (*hash64)(const void *, size_t, uint64_t),
+		uint64_t seed)
+{
+	assert(hash64 != NULL);
+	xf_htable_construct(t, size_bits, value_size, NULL);
+	t->hash64 = hash64;
+	t->seed = seed;
+}
+
+/**
+ * xf_htable_hashof() - hash a key with whichever function the table uses
+ * @t:		hashtable
+ * @key:	key to hash
+ * @keylen:	length of @key
+ *
+ * Return:	the hash as stored in buckets
+ */
+static inline uint32_t xf_htable_hashof(struct xf_htable *t, const void *key,
+		size_t keylen)
+{
+	if (t->hash != NULL)
+		return t->hash(key, keylen);
+	uint64_t h = t->hash64(key, keylen, t->seed);
+	return (uint32_t) (h ^ (h >> 32));
+}
+
+XFFNC uint32_t xf_htable_hash(struct xf_htable *t, const void *key,
+		size_t keylen)
+{
+	return xf_htable_hashof(t, key, keylen);
+}
+
+/**
+ * xf_htable_free_buckets() - free a list of buckets and the buckets in it
+ * @buckets:	the list
+ * @mask:	its amount of buckets minus one
+ */
+static void xf_htable_free_buckets(struct xf_htable_bucket **buckets,
+		uint32_t mask)
+{
+	size_t i, l;
+	for (i = 0, l = (size_t) mask + 1; i < l; i++) {
+		if (buckets[i] == NULL) continue;
+		free(buckets[i]);
+	}
+	free(buckets);
+}
+
+XFFNC void xf_htable_own_keys(struct xf_htable *t, size_t initsize)
+{
+	assert(t->count == 0 && t->keys == NULL);
+	t->keys = xf_mregion_create(initsize ? initsize : 4096);
+	t->keys->align = 1; /* packed */
+}
+
+XFFNC void xf_htable_use_dense(struct xf_htable *t)
+{
+	assert(t->count == 0 && t->dense == NULL);
+	struct xf_htable_dense *d = malloc(sizeof(*d));
+	assert(d != NULL);
+	d->value_size = t->value_size;
+	d->entry_size = (sizeof(struct xf_htable_entry) + d->value_size
+			+ sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	d->entries = NULL;
+	d->length = 0;
+	d->size = 0;
+	d->dead = 0;
+	t->dense = d;
+	t->value_size = sizeof(size_t); /* buckets hold positions */
+}
+
+/**
+ * xf_htable_dense_entry() - get an entry of the dense array
+ * @d:		the dense array
+ * @pos:	position of the entry
+ */
+static inline struct xf_htable_entry *xf_htable_dense_entry(
+		struct xf_htable_dense *d, size_t pos)
+{
+	return (struct xf_htable_entry *) (d->entries + pos * d->entry_size);
+}
+
+/**
+ * xf_htable_value() - get the value of an entry in a bucket
+ * @t:		hashtable
+ * @b:		the bucket
+ * @index:	position of the entry in @b
+ *
+ * Return:	pointer to the value, in the dense array in dense mode
+ */
+static inline void *xf_htable_value(struct xf_htable *t,
+		struct xf_htable_bucket *b, int index)
+{
+	void *v = xf_htable_bucket_val(t, b, index);
+	if (t->dense == NULL)
+		return v;
+	size_t pos;
+	memcpy(&pos, v, sizeof(pos));
+	return xf_htable_dense_entry(t->dense, pos) + 1;
+}
+
+/* size of values as seen by users of the table */
+static inline size_t xf_htable_vsize(struct xf_htable *t)
+{
+	return t->dense != NULL ? t->dense->value_size : t->value_size;
+}
+
+XFFNC void xf_htable_destruct(struct xf_htable *t)
+{
+	xf_htable_free_buckets(t->buckets, t->res_mask);
+	if (t->old_buckets != NULL) {
+		xf_htable_free_buckets(t->old_buckets, t->old_mask);
+		t->old_buckets = NULL;
+	}
+	if (t->keys != NULL) {
+		xf_mregion_destroy(t->keys);
+		t->keys = NULL;
+	}
+	if (t->dense != NULL) {
+		free(t->dense->entries);
+		free(t->dense);
+		t->dense = NULL;
+	}
+}
+
+XFFNC void xf_htable_clear(struct xf_htable *t)
+{
+	size_t i, l;
+	for (i = 0, l = (size_t) t->res_mask + 1; i < l; i++) {
+		if (t->buckets[i] == NULL) continue;
+		t->buckets[i]->length = 0;
+	}
+	if (t->old_buckets != NULL) {
+		xf_htable_free_buckets(t->old_buckets, t->old_mask);
+		t->old_buckets = NULL;
+	}
+	if (t->keys != NULL)
+		xf_mregion_clear(t->keys);
+	if (t->dense != NULL) {
+		t->dense->length = 0;
+		t->dense->dead = 0;
+	}
+	t->count = 0;
+}
+
+/**
+ * xf_htable_bucket_bytes() - bytes to allocate for a bucket
+ * @t:		hashtable
+ * @size:	how many entries the bucket should hold
+ *
+ * Return:	size of the bucket header, keys, values and hashes
+ */
+static inline size_t xf_htable_bucket_bytes(struct xf_htable *t, size_t size)
+{
+	size_t off = (sizeof(union xf_htable_key) + t->value_size) * size;
+	off = (off + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+	return sizeof(struct xf_htable_bucket) + off + sizeof(uint32_t) * size;
+}
+
+XFFNC size_t xf_htable_memcnt(struct xf_htable *t)
+{
+	assert(t->hash != NULL || t->hash64 != NULL);
+	assert(t->buckets != NULL);
+	size_t cnt = 0;
+	cnt += ((size_t) t->res_mask + 1) * sizeof(void *);
+
+	size_t i, l;
+	for (i = 0, l = (size_t) t->res_mask + 1; i < l; i++) {
+		struct xf_htable_bucket *b = t->buckets[i];
+		if (!b)
+			continue;
+		cnt += xf_htable_bucket_bytes(t, b->size);
+	}
+	if (t->keys != NULL)
+		cnt += xf_mregion_memcnt(t->keys);
+	if (t->dense != NULL)
+		cnt += sizeof(*t->dense) + t->dense->size * t->dense->entry_size;
+	if (t->old_buckets == NULL)
+		return cnt;
+	cnt += ((size_t) t->old_mask + 1) * sizeof(void *);
+	for (i = 0, l = (size_t) t->old_mask + 1; i < l; i++) {
+		struct xf_htable_bucket *b = t->old_buckets[i];
+		if (!b)
+			continue;
+		cnt += xf_htable_bucket_bytes(t, b->size);
+	}
+	return cnt;
+}
+
+/* entries in bucket @i of @bs, 0 if there's no such list */
+static inline size_t xf_htable_bucket_len(struct xf_htable_bucket **bs,
+		size_t i)
+{
+	return bs != NULL && bs[i] != NULL ? bs[i]->length : 0;
+}
+
+XFFNC void xf_htable_stats(struct xf_htable *t, struct xf_htable_stats *st)
+{
+	struct xf_htable_bucket **lists[2] = {t->buckets, t->old_buckets};
+	uint32_t masks[2] = {t->res_mask, t->old_mask};
+	/* old buckets before the cursor have all been moved already */
+	size_t from[2] = {0, t->migrate};
+	size_t hits = 0, entries = 0, i, l;
+	int k, j;
+
+	memset(st, 0, sizeof(*st));
+	for (k = 0; k < 2 && lists[k] != NULL; k++) {
+		for (i = from[k], l = (size_t) masks[k] + 1; i < l; i++) {
+			struct xf_htable_bucket *b = lists[k][i];
+			size_t len = b != NULL ? b->length : 0;
+			st->buckets++;
+			st->empty += len == 0;
+			st->hist[len < XF_HTABLE_STATS_HIST ? len
+				: XF_HTABLE_STATS_HIST - 1]++;
+			if (b == NULL)
+				continue;
+			st->slots += b->size;
+			st->wasted += b->size - b->length;
+			uint32_t *hs = xf_htable_bucket_hash(t, b);
+			for (j = 0; j < b->length; j++) {
+				/* keys in old buckets are looked for in the
+				 * current bucket first */
+				size_t scan = j + 1 + (k == 0 ? 0
+					: xf_htable_bucket_len(t->buckets,
+						hs[j] & t->res_mask));
+				if (b->data[j].accesstyp
+						== XF_HTABLE_KEY_DIRECT)
+					st->direct++;
+				else
+					st->indirect++;
+				hits += scan;
+				if (scan > st->hit_max)
+					st->hit_max = scan;
+			}
+			entries += b->length;
+		}
+	}
+	st->hit_mean = entries ? (double) hits / entries : 0;
+
+	/* a miss scans the whole current bucket and the whole old bucket,
+	 * the old list being the smaller one each current bucket has one */
+	size_t misses = 0;
+	l = (size_t) t->res_mask + 1;
+	for (i = 0; i < l; i++) {
+		size_t scan = xf_htable_bucket_len(t->buckets, i & t->res_mask)
+			+ xf_htable_bucket_len(t->old_buckets,
+					i & t->old_mask);
+		misses += scan;
+		if (scan > st->miss_max)
+			st->miss_max = scan;
+	}
+	st->miss_mean = (double) misses / l;
+}
+
+/**
+ * xf_htable_key_set() - fill in a key the way it's stored in buckets
+ * @k:		key to fill in, unused bytes are zeroed
+ * @key:	the key
+ * @keylen:	length of @key
+ */
+static inline void xf_htable_key_set(union xf_htable_key *k, const void *key,
+		size_t keylen)
+{
+	memset(k, 0, sizeof(*k));
+	if (keylen <= XF_HTABLE_KEY_DIRECT_MAX) {
+		k->accesstyp = XF_HTABLE_KEY_DIRECT;
+		k->direct.length = keylen;
+		memcpy(k->direct.a, key, keylen);
+	} else {
+		k->accesstyp = XF_HTABLE_KEY_INDIRECT;
+		k->indirect.length = keylen;
+		k->indirect.ptr = key;
+	}
+}
+
+/**
+ * xf_htable_key_eq() - compare two keys stored as direct a word at a time
+ * @a:		key filled in with xf_htable_key_set()
+ * @b:		key filled in with xf_htable_key_set()
+ *
+ * As the unused bytes of direct keys are zeroed, comparing the whole
+ * union also compares the lengths.
+ */
+static inline int xf_htable_key_eq(const union xf_htable_key *a,
+		const union xf_htable_key *b)
+{
+	size_t i, wa, wb;
+	for (i = 0; i < sizeof(*a); i += sizeof(size_t)) {
+		memcpy(&wa, (const char *) a + i, sizeof(size_t));
+		memcpy(&wb, (const char *) b + i, sizeof(size_t));
+		if (wa != wb)
+			return 0;
+	}
+	return 1;
+}
+
+/**
+ * xf_htable_bucket_lookup() - find the index of a key in a bucket
+ * @t:		hashtable
+ * @b:		bucket to look in
+ * @hash:	full hash of @key
+ * @key:	key to look for
+ * @keylen:	length of @key
+ *
+ * The stored hashes are compared first, so only keys with an equal hash are
+ * looked at.
+ *
+ * Return:	index of the key in @b or -1 if not found
+ */
+static int xf_htable_bucket_lookup(struct xf_htable *t,
+		struct xf_htable_bucket *b, uint32_t hash,
+		const void *key, size_t keylen)
+{
+	uint32_t *hs = xf_htable_bucket_hash(t, b);
+	int i;
+	if (keylen <= XF_HTABLE_KEY_DIRECT_MAX) {
+		union xf_htable_key pk;
+		xf_htable_key_set(&pk, key, keylen);
+		for (i = 0; i < b->length; i++) {
+			if (hs[i] == hash && xf_htable_key_eq(b->data + i, &pk))
+				return i;
+		}
+	} else {
+		for (i = 0; i < b->length; i++) {
+			union xf_htable_key *k = b->data + i;
+			if (hs[i] == hash
+					&& k->accesstyp == XF_HTABLE_KEY_INDIRECT
+					&& k->indirect.length == keylen
+					&& !memcmp(k->indirect.ptr, key, keylen))
+				return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * xf_htable_bucket_resize() - allocate a bucket or make it larger
+ * @t:		hashtable
+ * @slot:	where the bucket is referenced from in a bucket list, the
+ *		bucket is allocated if %NULL and the reference updated if the
+ *		bucket moves
+ * @nsize:	entries the bucket should be able to hold, at most
+ *		%USHRT_MAX and no less than it holds already
+ *
+ * Return:	the bucket
+ */
+static struct xf_htable_bucket *xf_htable_bucket_resize(struct xf_htable *t,
+		struct xf_htable_bucket **slot, int nsize)
+{
+	struct xf_htable_bucket *b = *slot;
+	XF_HTABLE_COUNT(t->counters.reallocs++);
+	if (b == NULL) {
+		b = malloc(xf_htable_bucket_bytes(t, nsize));
+		b->size = nsize;
+		b->length = 0;
+		*slot = b;
+		return b;
+	}
+	assert(nsize >= b->length && nsize <= USHRT_MAX);
+	int osize = b->size;
+	b = realloc(b, xf_htable_bucket_bytes(t, nsize));
+	uint32_t *ohs = xf_htable_bucket_hash(t, b);
+	b->size = nsize;
+	/* move hashes then values over, the hashes lie beyond values */
+	memmove(xf_htable_bucket_hash(t, b), ohs,
+			b->length * sizeof(uint32_t));
+	memmove(((char *) b->data) + nsize * sizeof(union xf_htable_key),
+			((char *) b->data) +
+			osize * sizeof(union xf_htable_key),
+			b->length * t->value_size);
+	*slot = b;
+	return b;
+}
+
+/**
+ * xf_htable_bucket_room() - make room for one more entry in a bucket
+ * @t:		hashtable
+ * @slot:	where the bucket is referenced from in a bucket list, the
+ *		bucket is allocated if %NULL and the reference updated if the
+ *		bucket moves
+ *
+ * Return:	the bucket or %NULL if it already holds %USHRT_MAX entries
+ */
+static struct xf_htable_bucket *xf_htable_bucket_room(struct xf_htable *t,
+		struct xf_htable_bucket **slot)
+{
+	struct xf_htable_bucket *b = *slot;
+	if (b == NULL) /* bucket capable of holding 1 pair */
+		return xf_htable_bucket_resize(t, slot, 1);
+	if (b->size > b->length)
+		return b;
+	/* expand bucket */
+	if (b->length + 1 > USHRT_MAX) {
+		return NULL;
+	}
+	int nsize = (XF_HTABLE_EXPANDFNC(b->size));
+	nsize = nsize > USHRT_MAX ? USHRT_MAX : nsize;
+	return xf_htable_bucket_resize(t, slot, nsize);
+}
+
+/* append entry @j of @ob to @b, which has room for it */
+static inline void xf_htable_bucket_move(struct xf_htable *t,
+		struct xf_htable_bucket *b, struct xf_htable_bucket *ob, int j)
+{
+	int k = b->length++;
+	b->data[k] = ob->data[j];
+	memcpy(xf_htable_bucket_val(t, b, k), xf_htable_bucket_val(t, ob, j),
+			t->value_size);
+	xf_htable_bucket_hash(t, b)[k] = xf_htable_bucket_hash(t, ob)[j];
+}
+
+/**
+ * xf_htable_migrate_bucket() - move an old bucket's entries to @t->buckets
+ * @t:		hashtable which is growing
+ * @i:		index of the bucket in @t->old_buckets
+ *
+ * The keys are placed by their stored hashes. As an old bucket only
+ * splits into new ones that haven't received other entries yet, there is
+ * always room for them.
+ */
+static void xf_htable_migrate_bucket(struct xf_htable *t, size_t i)
+{
+	struct xf_htable_bucket *ob = t->old_buckets[i];
+	if (ob == NULL)
+		return;
+	uint32_t *ohs = xf_htable_bucket_hash(t, ob);
+	int j;
+	for (j = 0; j < ob->length; j++) {
+		struct xf_htable_bucket *b = xf_htable_bucket_room(t,
+				&t->buckets[ohs[j] & t->res_mask]);
+		assert(b != NULL);
+		xf_htable_bucket_move(t, b, ob, j);
+	}
+	free(ob);
+	t->old_buckets[i] = NULL;
+}
+
+/**
+ * xf_htable_migrate() - move on with moving entries to the grown bucket list
+ * @t:		hashtable which is growing
+ * @hash:	hash of the key about to be used, its old bucket is moved first
+ * @n:		how many other non-empty old buckets to move at most
+ *
+ * Frees @t->old_buckets once all of them have been moved.
+ */
+static void xf_htable_migrate(struct xf_htable *t, uint32_t hash, size_t n)
+{
+	size_t end = (size_t) t->old_mask + 1;
+	size_t scan = n * 16; /* bound the time spent on moved over slots */
+
+	xf_htable_migrate_bucket(t, hash & t->old_mask);
+	for (; n && scan && t->migrate < end; t->migrate++, scan--) {
+		if (t->old_buckets[t->migrate] == NULL)
+			continue;
+		xf_htable_migrate_bucket(t, t->migrate);
+		n--;
+	}
+	if (t->migrate < end)
+		return;
+	free(t->old_buckets);
+	t->old_buckets = NULL;
+}
+
+/**
+ * xf_htable_grow() - double the amount of buckets
+ * @t:		hashtable
+ *
+ * Only the list is allocated here, the entries are moved over later by
+ * xf_htable_migrate().
+ */
+static void xf_htable_grow(struct xf_htable *t)
+{
+	if (t->old_buckets != NULL) /* should have been done by now */
+		xf_htable_migrate(t, 0, (size_t) t->old_mask + 1);
+	size_t nb = ((size_t) t->res_mask + 1) * 2;
+	struct xf_htable_bucket **buckets = calloc(nb, sizeof(*buckets));
+	assert(buckets != NULL);
+	t->old_buckets = t->buckets;
+	t->old_mask = t->res_mask;
+	t->migrate = 0;
+	t->buckets = buckets;
+	t->res_mask = nb - 1;
+}
+
+/**
+ * xf_htable_prepare() - grow the table or move entries on as needed
+ * @t:		hashtable about to be modified
+ * @hash:	hash of the key that will be looked up in @t->buckets
+ */
+static inline void xf_htable_prepare(struct xf_htable *t, uint32_t hash)
+{
+	if (t->max_load && t->res_mask < UINT32_MAX && t->count
+			>= (size_t) t->max_load * ((size_t) t->res_mask + 1))
+		xf_htable_grow(t);
+	if (t->old_buckets != NULL)
+		xf_htable_migrate(t, hash, XF_HTABLE_MIGRATE);
+}
+
+/**
+ * xf_htable_rehash() - move all entries to a new bucket list at once
+ * @t:		hashtable which isn't growing
+ * @nb:		buckets in the new list, a power of two multiple of the
+ *		current amount
+ *
+ * Every new bucket is allocated once, at the size it ends up with.
+ */
+static void xf_htable_rehash(struct xf_htable *t, size_t nb)
+{
+	assert(t->old_buckets == NULL);
+	struct xf_htable_bucket **buckets = calloc(nb, sizeof(*buckets));
+	uint32_t *len = calloc(nb, sizeof(*len));
+	assert(buckets != NULL && len != NULL);
+	uint32_t mask = nb - 1;
+	size_t i, l = (size_t) t->res_mask + 1;
+	int j;
+
+	for (i = 0; i < l; i++) {
+		struct xf_htable_bucket *ob = t->buckets[i];
+		uint32_t *ohs = ob ? xf_htable_bucket_hash(t, ob) : NULL;
+		for (j = 0; ob && j < ob->length; j++)
+			len[ohs[j] & mask]++;
+	}
+	/* each new bucket takes from a single old one, so they fit */
+	for (i = 0; i < nb; i++)
+		if (len[i])
+			xf_htable_bucket_resize(t, &buckets[i], len[i]);
+	free(len);
+	for (i = 0; i < l; i++) {
+		struct xf_htable_bucket *ob = t->buckets[i];
+		if (ob == NULL)
+			continue;
+		uint32_t *ohs = xf_htable_bucket_hash(t, ob);
+		for (j = 0; j < ob->length; j++)
+			xf_htable_bucket_move(t, buckets[ohs[j] & mask], ob, j);
+		free(ob);
+	}
+	free(t->buckets);
+	t->buckets = buckets;
+	t->res_mask = mask;
+}
+
+XFFNC void xf_htable_reserve(struct xf_htable *t, size_t n)
+{
+	if (t->old_buckets != NULL)
+		xf_htable_migrate(t, 0, (size_t) t->old_mask + 1);
+	size_t nb = (size_t) t->res_mask + 1;
+	/* xf_htable_prepare() grows once count reaches max_load * nb */
+	while (t->max_load && nb <= UINT32_MAX / 2
+			&& n > (size_t) t->max_load * nb)
+		nb *= 2;
+	if (nb > (size_t) t->res_mask + 1)
+		xf_htable_rehash(t, nb);
+
+	struct xf_htable_dense *d = t->dense;
+	if (d != NULL && d->size < n) {
+		d->size = n;
+		d->entries = realloc(d->entries, d->size * d->entry_size);
+		assert(d->entries != NULL);
+	}
+}
+
+/**
+ * xf_htable_dense_append() - add an entry for a new key to the dense array
+ * @t:		hashtable in dense mode
+ * @b:		bucket the key was just added to
+ * @index:	position of the key in @b
+ * @hash:	hash of the key
+ *
+ * The value of the entry is left for the caller to set.
+ */
+static void xf_htable_dense_append(struct xf_htable *t,
+		struct xf_htable_bucket *b, int index, uint32_t hash)
+{
+	struct xf_htable_dense *d = t->dense;
+	if (d->length == d->size) {
+		d->size = d->size ? d->size * 2 : 16;
+		d->entries = realloc(d->entries, d->size * d->entry_size);
+		assert(d->entries != NULL);
+	}
+	size_t pos = d->length++;
+	struct xf_htable_entry *e = xf_htable_dense_entry(d, pos);
+	e->key = b->data[index];
+	e->hash = hash;
+	e->dead = 0;
+	memcpy(xf_htable_bucket_val(t, b, index), &pos, sizeof(pos));
+}
+
+/**
+ * xf_htable_dense_slot() - find the bucket value referring to an entry
+ * @t:		hashtable in dense mode
+ * @pos:	position of the entry in @t->dense
+ *
+ * Return:	pointer to the position stored in a bucket
+ */
+static void *xf_htable_dense_slot(struct xf_htable *t, size_t pos)
+{
+	uint32_t hash = xf_htable_dense_entry(t->dense, pos)->hash;
+	struct xf_htable_bucket *b = t->buckets[hash & t->res_mask];
+	int i, old = 0;
+	for (;;) {
+		uint32_t *hs = b ? xf_htable_bucket_hash(t, b) : NULL;
+		for (i = 0; b && i < b->length; i++) {
+			void *v = xf_htable_bucket_val(t, b, i);
+			if (hs[i] == hash && !memcmp(v, &pos, sizeof(pos)))
+				return v;
+		}
+		/* not moved over from the old buckets yet */
+		assert(!old && t->old_buckets != NULL);
+		b = t->old_buckets[hash & t->old_mask];
+		old = 1;
+	}
+}
+
+/**
+ * xf_htable_dense_kill() - mark a dense entry removed
+ * @t:		hashtable in dense mode
+ * @pos:	position of the entry, already removed from its bucket
+ *
+ * Once half the entries are dead, the live ones are moved down over them
+ * and the positions in the buckets updated.
+ */
+static void xf_htable_dense_kill(struct xf_htable *t, size_t pos)
+{
+	struct xf_htable_dense *d = t->dense;
+	xf_htable_dense_entry(d, pos)->dead = 1;
+	d->dead++;
+	if (d->dead < 16 || d->dead * 2 < d->length)
+		return;
+	size_t i, j;
+	for (i = j = 0; i < d->length; i++) {
+		struct xf_htable_entry *e = xf_htable_dense_entry(d, i);
+		if (e->dead)
+			continue;
+		if (i != j) {
+			memcpy(xf_htable_dense_slot(t, i), &j, sizeof(j));
+			memcpy(xf_htable_dense_entry(d, j), e, d->entry_size);
+		}
+		j++;
+	}
+	d->length = j;
+	d->dead = 0;
+}
+
+/**
+ * xf_htable_get() - gets a slot for key/value pair
+ * @t:		hashtable
+ * @hash:	hash of @key
+ * @key:	key to get the slot for
+ * @keylen:	length of @key
+ * @b:		where to return a reference to a bucket
+ * @pair_index:	where to write the index of the slot
+ *
+ * Return:	0 if XF_HTABLE_EFULL
+ *
+ *		1 if given key was already in the table and it was returned
+ *
+ *		2 if a new a new slot was allocated and returned
+ */
+static int xf_htable_get(struct xf_htable *t, uint32_t hash, const void *key,
+		size_t keylen, struct xf_htable_bucket **rb, int *rpair_index)
+{
+	assert(t != NULL && key != NULL && rb != NULL && rpair_index != NULL);
+	xf_htable_prepare(t, hash);
+	uint32_t bid = hash & t->res_mask;
+	struct xf_htable_bucket *b = t->buckets[bid];
+	/* look for a matching key already in table */
+	if (b != NULL) {
+		int i = xf_htable_bucket_lookup(t, b, hash, key, keylen);
+		if (i >= 0) {
+			*rpair_index = i;
+			*rb = b;
+			return 1;
+		}
+	}
+	/* no key in table - insert new*/
+	b = xf_htable_bucket_room(t, &t->buckets[bid]);
+	if (b == NULL)
+		return 0;
+
+	int b_index = b->length;
+	b->length++;
+	t->count++;
+	xf_htable_key_set(&b->data[b_index], key, keylen);
+	if (t->keys != NULL && keylen > XF_HTABLE_KEY_DIRECT_MAX)
+		b->data[b_index].indirect.ptr = memcpy(
+				xf_mregion_alloc(t->keys, keylen), key, keylen);
+	xf_htable_bucket_hash(t, b)[b_index] = hash;
+	if (t->dense != NULL)
+		xf_htable_dense_append(t, b, b_index, hash);
+	*rpair_index = b_index;
+	*rb = b;
+	return 2;
+}
+
+/**
+ * xf_htable_lookup() - find the value of a key with known hash
+ * @t:		hashtable
+ * @hash:	hash of @key
+ * @key:	key to search for
+ * @keylen:	length of @key
+ *
+ * Return:	pointer to the value or %NULL
+ */
+static void *xf_htable_lookup(struct xf_htable *t, uint32_t hash,
+		const void *key, size_t keylen)
+{
+	struct xf_htable_bucket *b = t->buckets[hash & t->res_mask];
+	int i;
+
+	XF_HTABLE_COUNT(t->counters.lookups++);
+	if (b != NULL && (i = xf_htable_bucket_lookup(t, b, hash, key, keylen))
+			>= 0)
+		goto found;
+	/* the key might not have been moved over yet */
+	if (t->old_buckets == NULL
+			|| !(b = t->old_buckets[hash & t->old_mask]))
+		return NULL;
+	i = xf_htable_bucket_lookup(t, b, hash, key, keylen);
+	if (i < 0)
+		return NULL;
+found:
+	XF_HTABLE_COUNT(t->counters.hits++);
+	return xf_htable_value(t, b, i);
+}
+
+XFFNC void *xf_htable_find_hashed(struct xf_htable *t, uint32_t hash,
+		const void *key, size_t keylen)
+{
+	return xf_htable_lookup(t, hash, key, keylen);
+}
+
+XFFNC void *xf_htable_find(struct xf_htable *t, const void *key, size_t keylen)
+{
+	return xf_htable_lookup(t, xf_htable_hashof(t, key, keylen), key,
+			keylen);
+}
+
+XFFNC int xf_htable_add_hashed(struct xf_htable *t, uint32_t hash,
+		const void *key, size_t keylen, const void *value_in)
+{
+	struct xf_htable_bucket *b;
+	int b_index;
+	int rv = xf_htable_get(t, hash, key, keylen, &b, &b_index);
+	if (!rv)
+		return XF_HTABLE_EFULL;
+	else if (rv == 1)
+		return XF_HTABLE_ESET;
+
+	memcpy(xf_htable_value(t, b, b_index), value_in, xf_htable_vsize(t));
+	return XF_HTABLE_ESUCCESS;
+}
+
+XFFNC int xf_htable_add(struct xf_htable *t, const void *key, size_t keylen,
+		const void *value_in)
+{
+	return xf_htable_add_hashed(t, xf_htable_hashof(t, key, keylen), key,
+			keylen, value_in);
+}
+
+/* sizes the buckets for all of their new keys, so the adds after it
+ * neither grow the table nor reallocate a bucket; keys already in the
+ * table only leave some of the room unused */
+static void xf_htable_presize(struct xf_htable *t, size_t n,
+		const uint32_t *hash)
+{
+	size_t nb = (size_t) t->res_mask + 1, i;
+	uint32_t *more = calloc(nb, sizeof(*more));
+	assert(more != NULL);
+
+	for (i = 0; i < n; i++)
+		more[hash[i] & t->res_mask]++;
+	for (i = 0; i < nb; i++) {
+		if (!more[i])
+			continue;
+		struct xf_htable_bucket *b = t->buckets[i];
+		size_t size = (b ? b->length : 0) + (size_t) more[i];
+		size = size > USHRT_MAX ? USHRT_MAX : size;
+		if (b == NULL || b->size < size)
+			xf_htable_bucket_resize(t, &t->buckets[i], size);
+	}
+	free(more);
+}
+
+XFFNC size_t xf_htable_add_many(struct xf_htable *t, size_t n,
+		const void *const *keys, const size_t *keylens,
+		const void *values)
+{
+	size_t vsize = xf_htable_vsize(t), added = 0, i;
+	uint32_t *hash = malloc((n ? n : 1) * sizeof(*hash));
+	assert(hash != NULL);
+
+	xf_htable_reserve(t, t->count + n);
+	for (i = 0; i < n; i++)
+		hash[i] = xf_htable_hashof(t, keys[i], keylens[i]);
+	/* counting takes a pass over all the buckets, which a batch getting
+	 * well under a key per bucket doesn't make up for */
+	if (n >= ((size_t) t->res_mask + 1) / XF_HTABLE_BULK_SPARSE)
+		xf_htable_presize(t, n, hash);
+	for (i = 0; i < n; i++)
+		added += xf_htable_add_hashed(t, hash[i], keys[i], keylens[i],
+				(const char *) values + i * vsize)
+			== XF_HTABLE_ESUCCESS;
+	free(hash);
+	return added;
+}
+
+XFFNC void *xf_htable_see_hashed(struct xf_htable *t, uint32_t hash,
+		const void *key, size_t keylen, const void *value_def)
+{
+	struct xf_htable_bucket *b;
+	int b_index;
+	int gv = xf_htable_get(t, hash, key, keylen, &b, &b_index);
+	if (!gv) {
+		return NULL;
+	}
+	void *val = xf_htable_value(t, b, b_index);
+	if (gv == 2) {
+		if (value_def == NULL)
+			memset(val, 0, xf_htable_vsize(t));
+		else
+			memcpy(val, value_def, xf_htable_vsize(t));
+	}
+	return val;
+}
+
+XFFNC void *xf_htable_see(struct xf_htable *t, const void *key, size_t keylen,
+		const void *value_def)
+{
+	return xf_htable_see_hashed(t, xf_htable_hashof(t, key, keylen), key,
+			keylen, value_def);
+}
+
+XFFNC int xf_htable_verify_hashed(struct xf_htable *t, uint32_t hash,
+		const void *key, size_t keylen, const void *value)
+{
+	void *v = xf_htable_lookup(t, hash, key, keylen);
+	if (v == NULL) return XF_HTABLE_ENOTFOUND;
+	return !memcmp(value, v, xf_htable_vsize(t))
+		? XF_HTABLE_ESUCCESS : XF_HTABLE_ENOTEQUAL;
+}
+
+XFFNC int xf_htable_verify(struct xf_htable *t, const void *key, size_t keylen,
+		const void *value)
+{
+	return xf_htable_verify_hashed(t, xf_htable_hashof(t, key, keylen), key,
+			keylen, value);
+}
+
+XFFNC size_t xf_htable_find_many(struct xf_htable *t, size_t n,
+		const void *const *keys, const size_t *keylens, void **values)
+{
+	uint32_t hash[XF_HTABLE_BATCH];
+	size_t found = 0, at, m, i;
+
+	for (at = 0; at < n; at += m) {
+		m = n - at < XF_HTABLE_BATCH ? n - at : XF_HTABLE_BATCH;
+		/* hash, fetch the bucket pointers */
+		for (i = 0; i < m; i++) {
+			hash[i] = xf_htable_hashof(t, keys[at + i],
+					keylens[at + i]);
+			XF_HTABLE_PREFETCH(&t->buckets[hash[i] & t->res_mask]);
+		}
+		/* fetch the start of the buckets, the keys */
+		for (i = 0; i < m; i++) {
+			struct xf_htable_bucket *b =
+				t->buckets[hash[i] & t->res_mask];
+			if (b != NULL)
+				XF_HTABLE_PREFETCH(b);
+		}
+		/* fetch the hashes the scan starts with */
+		for (i = 0; i < m; i++) {
+			struct xf_htable_bucket *b =
+				t->buckets[hash[i] & t->res_mask];
+			if (b != NULL)
+				XF_HTABLE_PREFETCH(xf_htable_bucket_hash(t, b));
+		}
+		for (i = 0; i < m; i++) {
+			values[at + i] = xf_htable_lookup(t, hash[i],
+					keys[at + i], keylens[at + i]);
+			found += values[at + i] != NULL;
+		}
+	}
+	return found;
+}
+
+/**
+ * xf_htable_bucket_remove() - remove an entry from a bucket
+ * @t:		hashtable
+ * @slot:	where the bucket is referenced from in @t->buckets, updated if
+ *		the bucket is shrunk or freed
+ * @index:	position of the entry to remove
+ *
+ * The last entry of the bucket is moved into the hole, so removal doesn't
+ * depend on the length of the bucket. Once few enough entries are left,
+ * %XF_HTABLE_SHRINKFNC decides how much smaller to make the bucket, and
+ * the bucket is freed when it's left empty.
+ */
+static void xf_htable_bucket_remove(struct xf_htable *t,
+		struct xf_htable_bucket **slot, int index)
+{
+	struct xf_htable_bucket *b = *slot;
+	uint32_t *hs = xf_htable_bucket_hash(t, b);
+	int last = --b->length;
+
+	if (index != last) {
+		b->data[index] = b->data[last];
+		memcpy(xf_htable_bucket_val(t, b, index),
+				xf_htable_bucket_val(t, b, last), t->value_size);
+		hs[index] = hs[last];
+	}
+	if (b->length == 0) {
+		free(b);
+		*slot = NULL;
+		return;
+	}
+	int nsize = XF_HTABLE_SHRINKFNC(b->size, b->length);
+	if (nsize >= b->size || nsize < b->length)
+		return;
+	/* move values then hashes down, the hashes lie beyond values */
+	memmove(((char *) b->data) + nsize * sizeof(union xf_htable_key),
+			xf_htable_bucket_val(t, b, 0),
+			b->length * t->value_size);
+	b->size = nsize;
+	memmove(xf_htable_bucket_hash(t, b), hs,
+			b->length * sizeof(uint32_t));
+	*slot = realloc(b, xf_htable_bucket_bytes(t, nsize));
+	XF_HTABLE_COUNT(t->counters.reallocs++);
+}
+
+XFFNC int xf_htable_remove(struct xf_htable *t, const void *key,
+		size_t keylen)
+{
+	return xf_htable_remove_hashed(t, xf_htable_hashof(t, key, keylen), key,
+			keylen);
+}
+
+XFFNC int xf_htable_remove_hashed(struct xf_htable *t, uint32_t hash,
+		const void *key, size_t keylen)
+{
+	assert(t != NULL);
+	assert(key != NULL);
+	assert(keylen > 0);
+	if (t->old_buckets != NULL)
+		xf_htable_migrate(t, hash, XF_HTABLE_MIGRATE);
+	struct xf_htable_bucket **slot = &t->buckets[hash & t->res_mask];
+
+	if (*slot == NULL)
+		return XF_HTABLE_ENOTFOUND;
+
+	int i = xf_htable_bucket_lookup(t, *slot, hash, key, keylen);
+	if (i < 0)
+		return XF_HTABLE_ENOTFOUND;
+	union xf_htable_key *k = (*slot)->data + i;
+	if (t->keys != NULL && k->accesstyp == XF_HTABLE_KEY_INDIRECT
+			&& (const char *) k->indirect.ptr + keylen
+			== t->keys->cur->data + t->keys->cur->length)
+		xf_mregion_undo(t->keys, (void *) k->indirect.ptr);
+	size_t pos = 0;
+	if (t->dense != NULL)
+		memcpy(&pos, xf_htable_bucket_val(t, *slot, i), sizeof(pos));
+	xf_htable_bucket_remove(t, slot, i);
+	if (t->dense != NULL)
+		xf_htable_dense_kill(t, pos);
+	t->count--;
+	return XF_HTABLE_ESUCCESS;
+}
+
+XFFNC void xf_htable_iter_init(struct xf_htable_iter *it, struct xf_htable *t)
+{
+	it->t = t;
+	it->pos = 0;
+	it->index = 0;
+	it->old = t->old_buckets != NULL;
+}
+
+XFFNC void *xf_htable_iter_next(struct xf_htable_iter *it, const void **key,
+		size_t *keylen)
+{
+	struct xf_htable *t = it->t;
+	union xf_htable_key *k;
+	void *v;
+
+	if (t->dense != NULL) {
+		struct xf_htable_dense *d = t->dense;
+		struct xf_htable_entry *e;
+		do {
+			if (it->pos >= d->length)
+				return NULL;
+			e = xf_htable_dense_entry(d, it->pos++);
+		} while (e->dead);
+		k = &e->key;
+		v = e + 1;
+	} else {
+		struct xf_htable_bucket *b;
+		for (;;) {
+			struct xf_htable_bucket **bs = it->old
+				? t->old_buckets : t->buckets;
+			size_t end = (size_t) (it->old ? t->old_mask
+					: t->res_mask) + 1;
+			for (; it->pos < end; it->pos++, it->index = 0) {
+				b = bs[it->pos];
+				if (b != NULL && it->index < b->length)
+					goto found;
+			}
+			if (!it->old)
+				return NULL;
+			it->old = 0;
+			it->pos = 0;
+		}
+found:
+		k = b->data + it->index;
+		v = xf_htable_bucket_val(t, b, it->index);
+		it->index++;
+	}
+	if (key != NULL)
+		*key = k->accesstyp == XF_HTABLE_KEY_DIRECT
+			? (const void *) k->direct.a : k->indirect.ptr;
+	if (keylen != NULL)
+		*keylen = k->accesstyp == XF_HTABLE_KEY_DIRECT
+			? k->direct.length : k->indirect.length;
+	return v;
+}
+
+#if XF_HTABLE_FILE
+XFFNC int xf_htable_save(struct xf_htable *t, const char *path)
+{
+	assert(path != NULL);
+	struct xf_htable_bucket **lists[2] = {t->buckets, t->old_buckets};
+	uint32_t masks[2] = {t->res_mask, t->old_mask};
+	/* old buckets before the cursor have all been moved already */
+	size_t from[2] = {0, t->migrate};
+	size_t keylen, i, l;
+	size_t n = t->count, nb = (size_t) t->res_mask + 1;
+	size_t vsize = xf_htable_vsize(t), keybytes = 0;
+	int k, j;
+
+	/* the image's buckets are the current ones, whatever still is in the
+	 * old ones is put where it would be moved to, going by the hashes
+	 * the buckets keep */
+	uint64_t *count = calloc(nb + 1, sizeof(*count));
+	assert(count != NULL);
+	for (k = 0; k < 2 && lists[k] != NULL; k++) {
+		for (i = from[k], l = (size_t) masks[k] + 1; i < l; i++) {
+			struct xf_htable_bucket *b = lists[k][i];
+			if (b == NULL)
+				continue;
+			uint32_t *hs = xf_htable_bucket_hash(t, b);
+			for (j = 0; j < b->length; j++) {
+				count[hs[j] & t->res_mask]++;
+				keylen = b->data[j].accesstyp
+					== XF_HTABLE_KEY_DIRECT
+					? b->data[j].direct.length
+					: b->data[j].indirect.length;
+				if (keylen > sizeof(((struct
+						xf_htable_image_entry *) 0)->key))
+					keybytes += keylen;
+			}
+		}
+	}
+
+	size_t at = sizeof(struct xf_htable_image);
+	size_t idx_off = at;
+	at += (nb + 1) * sizeof(uint64_t);
+	size_t ent_off = at;
+	at += n * sizeof(struct xf_htable_image_entry);
+	size_t val_off = at;
+	at += (n * vsize + 7) & ~(size_t) 7;
+	size_t key_off = at;
+	at += keybytes;
+
+	char *img = calloc(1, at);
+	assert(img != NULL);
+	struct xf_htable_image *h = (struct xf_htable_image *) img;
+	memcpy(h->magic, XF_HTABLE_FILE_MAGIC, sizeof(h->magic));
+	h->version = XF_HTABLE_FILE_VERSION;
+	h->value_size = vsize;
+	h->res_mask = t->res_mask;
+	h->hash64 = t->hash == NULL;
+	h->seed = t->seed;
+	h->count = n;
+	h->length = at;
+	h->index = idx_off;
+	h->entries = ent_off;
+	h->values = val_off;
+	h->keys = key_off;
+
+	/* index[b] is where the next entry of bucket b goes */
+	uint64_t *index = (uint64_t *) (img + idx_off);
+	for (i = 0; i < nb; i++)
+		index[i + 1] = index[i] + count[i];
+	free(count);
+
+	struct xf_htable_image_entry *ent =
+		(struct xf_htable_image_entry *) (img + ent_off);
+	size_t koff = 0;
+	for (k = 0; k < 2 && lists[k] != NULL; k++) {
+		for (i = from[k], l = (size_t) masks[k] + 1; i < l; i++) {
+			struct xf_htable_bucket *b = lists[k][i];
+			if (b == NULL)
+				continue;
+			uint32_t *hs = xf_htable_bucket_hash(t, b);
+			for (j = 0; j < b->length; j++) {
+				union xf_htable_key *hk = &b->data[j];
+				const void *key = hk->accesstyp
+					== XF_HTABLE_KEY_DIRECT
+					? (const void *) hk->direct.a
+					: hk->indirect.ptr;
+				keylen = hk->accesstyp == XF_HTABLE_KEY_DIRECT
+					? hk->direct.length
+					: hk->indirect.length;
+				uint64_t pos = index[hs[j] & t->res_mask]++;
+				ent[pos].hash = hs[j];
+				ent[pos].length = keylen;
+				if (keylen <= sizeof(ent[pos].key)) {
+					memcpy(ent[pos].key.a, key, keylen);
+				} else {
+					ent[pos].key.off = koff;
+					memcpy(img + key_off + koff, key,
+							keylen);
+					koff += keylen;
+				}
+				memcpy(img + val_off + pos * vsize,
+						xf_htable_value(t, b, j), vsize);
+			}
+		}
+	}
+	/* every index[b] got moved to the start of bucket b + 1 */
+	memmove(index + 1, index, nb * sizeof(*index));
+	index[0] = 0;
+
+	int rv = -1;
+	FILE *f = fopen(path, "wb");
+	if (f != NULL) {
+		rv = fwrite(img, 1, at, f) == at ? 0 : -1;
+		if (fclose(f) != 0)
+			rv = -1;
+	}
+	free(img);
+	return rv;
 }
 
-XFFNC void xf_htable_destruct(struct xf_htable *t)
+/**
+ * xf_htable_mapped_hash() - xf_htable_hashof() for a mapped table
+ * @m:		the mapped table
+ * @key:	key to hash
+ * @keylen:	length of @key
+ *
+ * Return:	the hash as stored in the entries
+ */
+static inline uint32_t xf_htable_mapped_hash(const struct xf_htable_mapped *m,
+		const void *key, size_t keylen)
 {
-	int i, l;
-	for (i = 0, l = 1 + t->res_mask; i < l; i++) {
-		if (t->buckets[i] == NULL) continue;
-		free(t->buckets[i]);
-	}
-	free(t->buckets);
+	if (m->hash != NULL)
+		return m->hash(key, keylen);
+	uint64_t h = m->hash64(key, keylen, m->img->seed);
+	return (uint32_t) (h ^ (h >> 32));
 }
 
-XFFNC void xf_htable_clear(struct xf_htable *t)
+/* the bytes of a key in a mapped table */
+static inline const void *xf_htable_mapped_key(const struct xf_htable_mapped *m,
+		const struct xf_htable_image_entry *e)
 {
-	int i, l;
-	for (i = 0, l = 1 + t->res_mask; i < l; i++) {
-		if (t->buckets[i] == NULL) continue;
-		t->buckets[i]->length = 0;
-	}
+	if (e->length <= sizeof(e->key))
+		return e->key.a;
+	return (const char *) m->img + m->img->keys + e->key.off;
 }
 
-XFFNC size_t xf_htable_memcnt(struct xf_htable *t)
+/**
+ * xf_htable_mapped_lookup() - find the entry of a key in a mapped table
+ * @m:		the mapped table
+ * @key:	key to search for
+ * @keylen:	length of @key
+ *
+ * Return:	index of the entry of @key or -1 if it isn't in @m
+ */
+static long xf_htable_mapped_lookup(const struct xf_htable_mapped *m,
+		const void *key, size_t keylen)
 {
-	assert(t->hash != NULL);
-	assert(t->buckets != NULL);
-	size_t cnt = 0;
-	cnt += (t->res_mask + 1) * sizeof(void *);
+	const struct xf_htable_image *img = m->img;
+	const char *base = (const char *) img;
+	const uint64_t *index = (const uint64_t *) (base + img->index);
+	const struct xf_htable_image_entry *ent =
+		(const struct xf_htable_image_entry *) (base + img->entries);
+	uint32_t hash = xf_htable_mapped_hash(m, key, keylen);
+	uint64_t i = index[hash & img->res_mask];
+	uint64_t end = index[(hash & img->res_mask) + 1];
 
-	int i, l;
-	for (i = 0, l = t->res_mask + 1; i < l; i++) {
-		struct xf_htable_bucket *b = t->buckets[i];
-		if (!b)
-			continue;
-		cnt += sizeof(struct xf_htable_bucket)
-			+ sizeof(union xf_htable_key) * b->size
-			+ t->value_size * b->size;
-	}
-	return cnt;
+	for (; i < end; i++)
+		if (ent[i].hash == hash && ent[i].length == keylen
+				&& !memcmp(xf_htable_mapped_key(m, ent + i),
+					key, keylen))
+			return i;
+	return -1;
 }
 
 /**
- * xf_htable_get() - gets a slot for key/value pair
- * @t:		hashtable
- * @key:	key to get the slot for
- * @keylen:	length of @key
- * @b:		where to return a reference to a bucket
- * @pair_index:	where to write the index of the slot
- *
- * Return:	0 if XF_HTABLE_EFULL
+ * xf_htable_image_check() - see to that a mapped image can be read safely
+ * @img:	the mapping, at least @img->length bytes and a header long
  *
- *		1 if given key was already in the table and it was returned
+ * Lookups trust the sections, the bucket index and the key offsets, so
+ * all of them are checked to lie within the image once, up front.
  *
- *		2 if a new a new slot was allocated and returned
+ * Return:	nonzero if @img is a well formed saved table
  */
-static int xf_htable_get(struct xf_htable *t, const void *key, size_t keylen,
-		struct xf_htable_bucket **rb, int *rpair_index)
+static int xf_htable_image_check(const struct xf_htable_image *img)
 {
-	assert(t != NULL && key != NULL && rb != NULL && rpair_index != NULL);
-	uint32_t bid = t->hash(key, keylen) & t->res_mask;
-	struct xf_htable_bucket *b;
-	if (t->buckets[bid] == NULL) {
-		/* bucket capable of holding 1 pair */
-		b = malloc(sizeof(struct xf_htable_bucket)
-				+ 1 * sizeof(union xf_htable_key)
-				+ 1 * t->value_size);
-		b->size = 1;
-		b->length = 0;
-		t->buckets[bid] = b;
-		goto newentry;
-	} else {
-		b = t->buckets[bid];
-	}
-	/* look for a matching key already in table */
-	int i;
-	for (i = 0; i < b->length; i++) {
-		if (b->data[i].accesstyp == XF_HTABLE_KEY_DIRECT
-				&& b->data[i].direct.length == keylen
-				&& !memcmp(b->data[i].direct.a, key, keylen)) {
-			*rpair_index = i;
-			*rb = b;
-			return 1;
-		} else if (b->data[i].indirect.length == keylen
-				&& !memcmp(b->data[i].indirect.ptr, key, keylen)) {
-			*rpair_index = i;
-			*rb = b;
-			return 1;
-		}
-	}
-	/* no key in table - insert new*/
-	if (b->size <= b->length) { /* expand bucket? */
-		if (b->length + 1 > USHRT_MAX) {
+	const char *base = (const char *) img;
+	uint64_t nb = (uint64_t) img->res_mask + 1, i;
+
+	if (memcmp(img->magic, XF_HTABLE_FILE_MAGIC, sizeof(img->magic))
+			|| img->version != XF_HTABLE_FILE_VERSION
+			|| img->index < sizeof(*img) || img->index % 8
+			|| img->entries % 8
+			|| img->entries < img->index
+			|| img->entries > img->length
+			|| (img->entries - img->index) / sizeof(uint64_t) < nb + 1
+			|| img->count > (img->length - img->entries)
+				/ sizeof(struct xf_htable_image_entry)
+			|| img->values < img->entries + img->count
+				* sizeof(struct xf_htable_image_entry)
+			|| img->values > img->length
+			|| (img->value_size && img->count > (img->length
+					- img->values) / img->value_size)
+			|| img->keys < img->values + img->count * img->value_size
+			|| img->keys > img->length)
+		return 0;
+
+	const uint64_t *index = (const uint64_t *) (base + img->index);
+	if (index[0] != 0 || index[nb] != img->count)
+		return 0;
+	for (i = 0; i < nb; i++)
+		if (index[i] > index[i + 1])
 			return 0;
-		}
-		int nsize = (XF_HTABLE_EXPANDFNC(b->size));
-		nsize = nsize > USHRT_MAX ? USHRT_MAX : nsize;
-		b = realloc(b, sizeof(struct xf_htable_bucket)
-				+ sizeof(union xf_htable_key) * nsize
-				+ t->value_size * nsize);
-		/* move values over */
-		memmove(((char *) b->data) + nsize * sizeof(union xf_htable_key),
-				((char *) b->data) +
-				b->size * sizeof(union xf_htable_key),
-				b->length * t->value_size);
-		b->size = nsize;
-		t->buckets[bid] = b; /* lol */
+
+	const struct xf_htable_image_entry *ent =
+		(const struct xf_htable_image_entry *) (base + img->entries);
+	uint64_t keybytes = img->length - img->keys;
+	for (i = 0; i < img->count; i++)
+		if (ent[i].length > sizeof(ent[i].key)
+				&& (ent[i].key.off > keybytes || ent[i].length
+					> keybytes - ent[i].key.off))
+			return 0;
+	return 1;
+}
+
+XFFNC int xf_htable_open_mapped(struct xf_htable_mapped *m, const char *path,
+		uint32_t (*hash)(const char *, int),
+		uint64_t (*hash64)(const void *, size_t, uint64_t))
+{
+	assert(path != NULL && (hash != NULL || hash64 != NULL));
+	struct stat st;
+	const struct xf_htable_image *img;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0
+			|| (size_t) st.st_size < sizeof(*img)) {
+		close(fd);
+		return -1;
 	}
+	img = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (img == MAP_FAILED)
+		return -1;
 
+	int ok = img->length == (uint64_t) st.st_size
+		&& (hash == NULL) == (img->hash64 != 0)
+		&& xf_htable_image_check(img);
 
-newentry:;
-	int b_index = b->length;
-	b->length++;
-	union xf_htable_key *k = &b->data[b_index];
-	if (keylen <= XF_HTABLE_KEY_DIRECT_MAX) {
-		k->accesstyp = XF_HTABLE_KEY_DIRECT;
-		k->direct.length = keylen;
-		memcpy(k->direct.a, key, keylen);
-	} else {
-		k->accesstyp = XF_HTABLE_KEY_INDIRECT;
-		k->indirect.length = keylen;
-		k->indirect.ptr = key;
+	m->img = img;
+	m->hash = hash;
+	m->hash64 = hash64;
+	if (ok && img->count > 0) {
+		/* a different hash function would only show as keys not found */
+		const struct xf_htable_image_entry *e =
+			(const struct xf_htable_image_entry *)
+			((const char *) img + img->entries);
+		ok = xf_htable_mapped_hash(m, xf_htable_mapped_key(m, e),
+				e->length) == e->hash;
 	}
-	*rpair_index = b_index;
-	*rb = b;
-	return 2;
+	if (!ok) {
+		munmap((void *) img, st.st_size);
+		m->img = NULL;
+		return -1;
+	}
+	return 0;
 }
 
-XFFNC int xf_htable_add(struct xf_htable *t, const void *key, size_t keylen,
-		const void *value_in)
+XFFNC const void *xf_htable_mapped_find(const struct xf_htable_mapped *m,
+		const void *key, size_t keylen)
 {
-	struct xf_htable_bucket *b;
-	int b_index;
-	int rv = xf_htable_get(t, key, keylen, &b, &b_index);
-	if (!rv)
-		return XF_HTABLE_EFULL;
-	else if (rv == 1)
-		return XF_HTABLE_ESET;
+	long i = xf_htable_mapped_lookup(m, key, keylen);
+	if (i < 0)
+		return NULL;
+	return (const char *) m->img + m->img->values
+		+ (size_t) i * m->img->value_size;
+}
 
-	memcpy(xf_htable_bucket_val(t, b, b_index), value_in,
-			t->value_size);
-	return XF_HTABLE_ESUCCESS;
+XFFNC int xf_htable_mapped_verify(const struct xf_htable_mapped *m,
+		const void *key, size_t keylen, const void *value)
+{
+	const void *v = xf_htable_mapped_find(m, key, keylen);
+	if (v == NULL)
+		return XF_HTABLE_ENOTFOUND;
+	return memcmp(v, value, m->img->value_size) ? XF_HTABLE_ENOTEQUAL
+		: XF_HTABLE_ESUCCESS;
 }
 
-XFFNC void *xf_htable_see(struct xf_htable *t, const void *key, size_t keylen,
-		const void *value_def)
+XFFNC void xf_htable_mapped_close(struct xf_htable_mapped *m)
 {
-	struct xf_htable_bucket *b;
-	int b_index;
-	int gv = xf_htable_get(t, key, keylen, &b, &b_index);
-	if (!gv) {
-		return NULL;
+	munmap((void *) m->img, m->img->length);
+	m->img = NULL;
+}
+#endif
+
+#if __GNUC__
+/* index of the calling thread for picking a reader slot, 0 if not yet set */
+static __thread unsigned int xf_htable_sync_self;
+static unsigned int xf_htable_sync_threads;
+
+static inline void xf_htable_sync_pause(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+XFFNC void xf_htable_sync_construct(struct xf_htable_sync *s,
+		unsigned int size_bits, size_t value_size,
+		uint32_t (*hash)(const char *,int))
+{
+	xf_htable_construct(&s->t, size_bits, value_size, hash);
+	s->t.max_load = 0;
+	s->stripes = calloc(XF_HTABLE_SYNC_STRIPES, sizeof(*s->stripes));
+	s->slots = calloc(XF_HTABLE_SYNC_SLOTS, sizeof(*s->slots));
+	assert(s->stripes != NULL && s->slots != NULL);
+	s->epoch = 0;
+	s->retired_len = 0;
+	s->retire_lock = 0;
+}
+
+XFFNC void xf_htable_sync_destruct(struct xf_htable_sync *s)
+{
+	struct xf_htable_iter it;
+	const void *key;
+	size_t keylen, i;
+
+	xf_htable_iter_init(&it, &s->t);
+	while (xf_htable_iter_next(&it, &key, &keylen)) {
+		if (keylen > XF_HTABLE_KEY_DIRECT_MAX)
+			free((void *) key);
 	}
-	void *val = xf_htable_bucket_val(t, b, b_index);
-	if (gv == 2) {
-		if (value_def == NULL)
-			memset(val, 0, t->value_size);
-		else
-			memcpy(val, value_def, t->value_size);
+	for (i = 0; i < s->retired_len; i++)
+		free(s->retired[i]);
+	free(s->stripes);
+	free(s->slots);
+	xf_htable_destruct(&s->t);
+}
+
+/**
+ * xf_htable_sync_enter() - mark the calling thread as reading the table
+ * @s:		the table
+ * @slot:	where to write the reader slot used
+ *
+ * Return:	the epoch to pass to xf_htable_sync_leave()
+ */
+static unsigned long xf_htable_sync_enter(struct xf_htable_sync *s,
+		struct xf_htable_epoch **slot)
+{
+	unsigned long e;
+
+	if (xf_htable_sync_self == 0)
+		xf_htable_sync_self = __atomic_add_fetch(
+				&xf_htable_sync_threads, 1, __ATOMIC_RELAXED);
+	*slot = &s->slots[xf_htable_sync_self % XF_HTABLE_SYNC_SLOTS];
+	for (;;) {
+		e = __atomic_load_n(&s->epoch, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&(*slot)->count[e & 1], 1, __ATOMIC_SEQ_CST);
+		/* a reclaim that started meanwhile might not have seen us */
+		if (__atomic_load_n(&s->epoch, __ATOMIC_SEQ_CST) == e)
+			return e;
+		__atomic_sub_fetch(&(*slot)->count[e & 1], 1, __ATOMIC_RELEASE);
 	}
-	return val;
 }
 
-XFFNC int xf_htable_verify(struct xf_htable *t, const void *key, size_t keylen,
-		const void *value)
+static inline void xf_htable_sync_leave(struct xf_htable_epoch *slot,
+		unsigned long e)
 {
-	void *v = xf_htable_find(t, key, keylen);
-	if (v == NULL) return XF_HTABLE_ENOTFOUND;
-	return !memcmp(value, v, t->value_size)
-		? XF_HTABLE_ESUCCESS : XF_HTABLE_ENOTEQUAL;
+	__atomic_sub_fetch(&slot->count[e & 1], 1, __ATOMIC_RELEASE);
 }
 
-XFFNC void *xf_htable_find(struct xf_htable *t, const void *key, size_t keylen)
+/**
+ * xf_htable_sync_retire() - free memory once no reader can be using it
+ * @s:		the table
+ * @mem:	memory no longer reachable from the table, or %NULL
+ *
+ * When %XF_HTABLE_SYNC_RETIRE pieces have gathered, the epoch is advanced
+ * and, after the readers that entered before have left, they are freed.
+ * Must not be called with a stripe locked, as readers might be waiting on
+ * it.
+ */
+static void xf_htable_sync_retire(struct xf_htable_sync *s, void *mem)
 {
-	uint32_t bid = t->hash(key, keylen) & t->res_mask;
-	struct xf_htable_bucket *b = t->buckets[bid];
+	size_t i;
 
-	if (b == NULL)
-		return NULL;
+	if (mem == NULL)
+		return;
+	while (__atomic_test_and_set(&s->retire_lock, __ATOMIC_ACQUIRE))
+		xf_htable_sync_pause();
+	if (s->retired_len == XF_HTABLE_SYNC_RETIRE) {
+		unsigned long e = s->epoch;
+		__atomic_store_n(&s->epoch, e + 1, __ATOMIC_SEQ_CST);
+		for (i = 0; i < XF_HTABLE_SYNC_SLOTS; i++) {
+			while (__atomic_load_n(&s->slots[i].count[e & 1],
+						__ATOMIC_ACQUIRE))
+				xf_htable_sync_pause();
+		}
+		for (i = 0; i < s->retired_len; i++)
+			free(s->retired[i]);
+		s->retired_len = 0;
+	}
+	s->retired[s->retired_len++] = mem;
+	__atomic_clear(&s->retire_lock, __ATOMIC_RELEASE);
+}
 
-	union xf_htable_key *k;
-	int i;
-	for (i = 0; i < b->length; i++) {
-		k = b->data + i;
-		if (k->accesstyp == XF_HTABLE_KEY_DIRECT
-				&& k->direct.length == keylen
-				&& !memcmp(k->direct.a, key, keylen))
-			return xf_htable_bucket_val(t, b, i);
-		else if (k->accesstyp == XF_HTABLE_KEY_INDIRECT
-				&& k->indirect.length == keylen
-				&& !memcmp(k->indirect.ptr, key, keylen))
-			return xf_htable_bucket_val(t, b, i);
+/**
+ * xf_htable_sync_lock() - lock a stripe and mark it as being written
+ * @st:		the stripe
+ */
+static void xf_htable_sync_lock(struct xf_htable_stripe *st)
+{
+	while (__atomic_test_and_set(&st->lock, __ATOMIC_ACQUIRE))
+		xf_htable_sync_pause();
+	__atomic_store_n(&st->seq, st->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void xf_htable_sync_unlock(struct xf_htable_stripe *st)
+{
+	__atomic_store_n(&st->seq, st->seq + 1, __ATOMIC_RELEASE);
+	__atomic_clear(&st->lock, __ATOMIC_RELEASE);
+}
+
+/**
+ * xf_htable_sync_copy() - copy a bucket into a new one
+ * @t:		the table
+ * @b:		bucket to copy, or %NULL
+ * @size:	size of the new bucket
+ * @skip:	index of an entry to leave out, or -1
+ *
+ * Return:	the new bucket
+ */
+static struct xf_htable_bucket *xf_htable_sync_copy(struct xf_htable *t,
+		struct xf_htable_bucket *b, int size, int skip)
+{
+	struct xf_htable_bucket *nb = malloc(xf_htable_bucket_bytes(t, size));
+	int i, j;
+	assert(nb != NULL);
+	XF_HTABLE_COUNT(__atomic_add_fetch(&t->counters.reallocs, 1,
+				__ATOMIC_RELAXED));
+	nb->size = size;
+	nb->length = 0;
+	for (i = j = 0; b != NULL && i < b->length; i++) {
+		if (i == skip)
+			continue;
+		nb->data[j] = b->data[i];
+		memcpy(xf_htable_bucket_val(t, nb, j),
+				xf_htable_bucket_val(t, b, i), t->value_size);
+		xf_htable_bucket_hash(t, nb)[j] = xf_htable_bucket_hash(t, b)[i];
+		j++;
+	}
+	nb->length = j;
+	return nb;
+}
+
+/**
+ * xf_htable_sync_put() - add or set a key in a shared table
+ * @s:		the table
+ * @key:	the key
+ * @keylen:	length of @key
+ * @value:	the value
+ * @overwrite:	whether to set the value of an existing key
+ */
+static int xf_htable_sync_put(struct xf_htable_sync *s, const void *key,
+		size_t keylen, const void *value, int overwrite)
+{
+	struct xf_htable *t = &s->t;
+	assert(key != NULL && keylen <= USHRT_MAX);
+	uint32_t hash = xf_htable_hashof(t, key, keylen);
+	uint32_t bid = hash & t->res_mask;
+	struct xf_htable_stripe *st =
+		&s->stripes[bid & (XF_HTABLE_SYNC_STRIPES - 1)];
+	struct xf_htable_bucket *b, *old = NULL;
+	int i, rv = XF_HTABLE_ESUCCESS;
+
+	xf_htable_sync_lock(st);
+	b = t->buckets[bid];
+	i = b == NULL ? -1 : xf_htable_bucket_lookup(t, b, hash, key, keylen);
+	if (i >= 0) {
+		if (overwrite)
+			memcpy(xf_htable_bucket_val(t, b, i), value,
+					t->value_size);
+		else
+			rv = XF_HTABLE_ESET;
+		goto out;
+	}
+	if (b == NULL || b->length == b->size) {
+		if (b != NULL && b->length == USHRT_MAX) {
+			rv = XF_HTABLE_EFULL;
+			goto out;
+		}
+		int nsize = b == NULL ? 1 : XF_HTABLE_EXPANDFNC(b->size);
+		nsize = nsize > USHRT_MAX ? USHRT_MAX : nsize;
+		old = b;
+		b = xf_htable_sync_copy(t, b, nsize, -1);
 	}
-	return NULL;
+	/* fill in the entry before readers can see it */
+	i = b->length;
+	xf_htable_key_set(&b->data[i], key, keylen);
+	if (keylen > XF_HTABLE_KEY_DIRECT_MAX) {
+		void *k = malloc(keylen);
+		assert(k != NULL);
+		b->data[i].indirect.ptr = memcpy(k, key, keylen);
+	}
+	memcpy(xf_htable_bucket_val(t, b, i), value, t->value_size);
+	xf_htable_bucket_hash(t, b)[i] = hash;
+	__atomic_store_n(&b->length, i + 1, __ATOMIC_RELEASE);
+	if (old != NULL || t->buckets[bid] == NULL)
+		__atomic_store_n(&t->buckets[bid], b, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&t->count, 1, __ATOMIC_RELAXED);
+out:
+	xf_htable_sync_unlock(st);
+	xf_htable_sync_retire(s, old);
+	return rv;
 }
 
-static void xf_htable_bucket_remove(struct xf_htable *t, struct xf_htable_bucket *b, int index)
+XFFNC int xf_htable_sync_add(struct xf_htable_sync *s, const void *key,
+		size_t keylen, const void *value)
 {
-	memmove(b->data + index, b->data + index + 1,
-			(b->length - index - 1) * sizeof(union xf_htable_key));
-	void *v = b->data + b->size;
-	memmove(v + t->value_size * index, v + t->value_size * index + 1,
-			(b->length - index - 1) * t->value_size);
-	b->length--;
+	return xf_htable_sync_put(s, key, keylen, value, 0);
 }
 
-XFFNC int xf_htable_remove(struct xf_htable *t, const void *key,
-		size_t keylen)
+XFFNC int xf_htable_sync_set(struct xf_htable_sync *s, const void *key,
+		size_t keylen, const void *value)
 {
-	assert(t != NULL);
-	assert(key != NULL);
-	assert(keylen > 0);
-	uint32_t bid = t->hash(key, keylen) & t->res_mask;
-	struct xf_htable_bucket *b = t->buckets[bid];
+	return xf_htable_sync_put(s, key, keylen, value, 1);
+}
 
-	if (b == NULL)
+XFFNC int xf_htable_sync_find(struct xf_htable_sync *s, const void *key,
+		size_t keylen, void *value)
+{
+	struct xf_htable *t = &s->t;
+	uint32_t hash = xf_htable_hashof(t, key, keylen);
+	uint32_t bid = hash & t->res_mask;
+	struct xf_htable_stripe *st =
+		&s->stripes[bid & (XF_HTABLE_SYNC_STRIPES - 1)];
+	struct xf_htable_epoch *slot;
+	unsigned long e = xf_htable_sync_enter(s, &slot);
+	unsigned int seq;
+	int i;
+
+	do {
+		while ((seq = __atomic_load_n(&st->seq, __ATOMIC_ACQUIRE)) & 1)
+			xf_htable_sync_pause();
+		struct xf_htable_bucket *b = __atomic_load_n(&t->buckets[bid],
+				__ATOMIC_ACQUIRE);
+		i = b == NULL ? -1
+			: xf_htable_bucket_lookup(t, b, hash, key, keylen);
+		if (i >= 0 && value != NULL)
+			memcpy(value, xf_htable_bucket_val(t, b, i),
+					t->value_size);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&st->seq, __ATOMIC_RELAXED) != seq);
+	xf_htable_sync_leave(slot, e);
+	XF_HTABLE_COUNT(__atomic_add_fetch(&t->counters.lookups, 1,
+				__ATOMIC_RELAXED));
+	if (i < 0)
 		return XF_HTABLE_ENOTFOUND;
+	XF_HTABLE_COUNT(__atomic_add_fetch(&t->counters.hits, 1,
+				__ATOMIC_RELAXED));
+	return XF_HTABLE_ESUCCESS;
+}
 
-	union xf_htable_key *k;
+XFFNC int xf_htable_sync_remove(struct xf_htable_sync *s, const void *key,
+		size_t keylen)
+{
+	struct xf_htable *t = &s->t;
+	uint32_t hash = xf_htable_hashof(t, key, keylen);
+	uint32_t bid = hash & t->res_mask;
+	struct xf_htable_stripe *st =
+		&s->stripes[bid & (XF_HTABLE_SYNC_STRIPES - 1)];
+	struct xf_htable_bucket *b, *nb = NULL;
+	void *k = NULL;
 	int i;
-	for (i = 0; i < b->length; i++) {
-		k = b->data + i;
-		if (k->accesstyp == XF_HTABLE_KEY_DIRECT) {
-			if (k->direct.length != keylen
-					|| memcmp(k->direct.a, key, keylen))
-				continue;
-		} else if (k->accesstyp == XF_HTABLE_KEY_INDIRECT) {
-			if (k->indirect.length != keylen
-					|| memcmp(k->indirect.ptr, key, keylen))
-				continue;
-		}
-		xf_htable_bucket_remove(t, b, i);
-		return XF_HTABLE_ESUCCESS;
+
+	xf_htable_sync_lock(st);
+	b = t->buckets[bid];
+	i = b == NULL ? -1 : xf_htable_bucket_lookup(t, b, hash, key, keylen);
+	if (i < 0) {
+		xf_htable_sync_unlock(st);
+		return XF_HTABLE_ENOTFOUND;
 	}
-	return XF_HTABLE_ENOTFOUND;
+	if (b->data[i].accesstyp == XF_HTABLE_KEY_INDIRECT)
+		k = (void *) b->data[i].indirect.ptr;
+	if (b->length > 1) {
+		int nsize = XF_HTABLE_SHRINKFNC(b->size, b->length - 1);
+		if (nsize < b->length - 1 || nsize > b->size)
+			nsize = b->size;
+		nb = xf_htable_sync_copy(t, b, nsize, i);
+	}
+	__atomic_store_n(&t->buckets[bid], nb, __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&t->count, 1, __ATOMIC_RELAXED);
+	xf_htable_sync_unlock(st);
+	xf_htable_sync_retire(s, b);
+	xf_htable_sync_retire(s, k);
+	return XF_HTABLE_ESUCCESS;
 }
-
+#endif
 
 /**
  * xf_hash_jenkins_oaat() - Bob Jenkins' One-at-a-Time hash
@@ -341,3 +1753,251 @@ XFFNC uint32_t xf_hash_hsieh_superfast(const char *data, int len)
 	return hash;
 }
 
+/* wyhash's primes, also used to derive the long key lane secrets */
+#define XF_HASH_P0 0xa0761d6478bd642full
+#define XF_HASH_P1 0xe7037ed1a0b428dbull
+#define XF_HASH_P2 0x8ebc6af09c88c6e3ull
+#define XF_HASH_P3 0x589965cc75374cc3ull
+
+/* keys longer than this go through the lane accumulator */
+#define XF_HASH_LONG 256
+
+static inline uint64_t xf_hash_r8(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap64(v);
+#endif
+	return v;
+}
+
+static inline uint64_t xf_hash_r4(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	v = __builtin_bswap32(v);
+#endif
+	return v;
+}
+
+/* 64x64 -> 128 bit multiply, low half to *a and high half to *b */
+static inline void xf_hash_mum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = *a;
+	r *= *b;
+	*a = (uint64_t) r;
+	*b = (uint64_t) (r >> 64);
+#else
+	uint64_t ha = *a >> 32, hb = *b >> 32;
+	uint64_t la = (uint32_t) *a, lb = (uint32_t) *b;
+	uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	uint64_t t = rl + (rm0 << 32), c = t < rl;
+	uint64_t lo = t + (rm1 << 32);
+	c += lo < t;
+	*a = lo;
+	*b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t xf_hash_mix(uint64_t a, uint64_t b)
+{
+	xf_hash_mum(&a, &b);
+	return a ^ b;
+}
+
+/*
+ * Long keys are consumed in 64 byte stripes by 8 lanes, xxh3 style:
+ * each lane adds the product of the low and high halves of its input
+ * word xor'ed with a secret and the neighbouring lane's plain input word.
+ * The scalar, SSE2 and AVX2 versions compute exactly the same.
+ */
+#define XF_HASH_STRIPE 64
+#define XF_HASH_BLOCK 16 /* stripes between scrambles */
+
+static void xf_hash_accum_scalar(uint64_t *acc, const uint8_t *p,
+		size_t stripes, const uint64_t *secret)
+{
+	size_t s;
+	int i;
+	for (s = 0; s < stripes; s++, p += XF_HASH_STRIPE) {
+		for (i = 0; i < 8; i++) {
+			uint64_t dv = xf_hash_r8(p + 8 * i);
+			uint64_t dk = dv ^ secret[i];
+			acc[i ^ 1] += dv;
+			acc[i] += (uint64_t) (uint32_t) dk * (dk >> 32);
+		}
+	}
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h> // _mm_* _mm256_*
+
+__attribute__((target("sse2")))
+static void xf_hash_accum_sse2(uint64_t *acc, const uint8_t *p,
+		size_t stripes, const uint64_t *secret)
+{
+	__m128i a[4], k[4];
+	size_t s;
+	int i;
+	for (i = 0; i < 4; i++) {
+		a[i] = _mm_loadu_si128((const __m128i *) acc + i);
+		k[i] = _mm_loadu_si128((const __m128i *) secret + i);
+	}
+	for (s = 0; s < stripes; s++, p += XF_HASH_STRIPE) {
+		for (i = 0; i < 4; i++) {
+			__m128i dv = _mm_loadu_si128((const __m128i *) p + i);
+			__m128i dk = _mm_xor_si128(dv, k[i]);
+			__m128i pr = _mm_mul_epu32(dk,
+					_mm_shuffle_epi32(dk, 0x31));
+			a[i] = _mm_add_epi64(a[i],
+					_mm_shuffle_epi32(dv, 0x4e));
+			a[i] = _mm_add_epi64(a[i], pr);
+		}
+	}
+	for (i = 0; i < 4; i++)
+		_mm_storeu_si128((__m128i *) acc + i, a[i]);
+}
+
+__attribute__((target("avx2")))
+static void xf_hash_accum_avx2(uint64_t *acc, const uint8_t *p,
+		size_t stripes, const uint64_t *secret)
+{
+	__m256i a[2], k[2];
+	size_t s;
+	int i;
+	for (i = 0; i < 2; i++) {
+		a[i] = _mm256_loadu_si256((const __m256i *) acc + i);
+		k[i] = _mm256_loadu_si256((const __m256i *) secret + i);
+	}
+	for (s = 0; s < stripes; s++, p += XF_HASH_STRIPE) {
+		for (i = 0; i < 2; i++) {
+			__m256i dv = _mm256_loadu_si256((const __m256i *) p + i);
+			__m256i dk = _mm256_xor_si256(dv, k[i]);
+			__m256i pr = _mm256_mul_epu32(dk,
+					_mm256_shuffle_epi32(dk, 0x31));
+			a[i] = _mm256_add_epi64(a[i],
+					_mm256_shuffle_epi32(dv, 0x4e));
+			a[i] = _mm256_add_epi64(a[i], pr);
+		}
+	}
+	for (i = 0; i < 2; i++)
+		_mm256_storeu_si256((__m256i *) acc + i, a[i]);
+}
+
+static void (*xf_hash_accum)(uint64_t *, const uint8_t *, size_t,
+		const uint64_t *) = xf_hash_accum_scalar;
+
+/* pick the widest accumulator the cpu supports at startup */
+__attribute__((constructor))
+static void xf_hash_dispatch(void)
+{
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		xf_hash_accum = xf_hash_accum_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		xf_hash_accum = xf_hash_accum_sse2;
+}
+#else
+#define xf_hash_accum xf_hash_accum_scalar
+#endif
+
+/**
+ * xf_hash_long() - hash a key longer than %XF_HASH_LONG bytes
+ * @p:		key
+ * @len:	length of @p
+ * @seed:	already mixed seed
+ */
+static uint64_t xf_hash_long(const uint8_t *p, size_t len, uint64_t seed)
+{
+	static const uint64_t lane[4] = {
+		XF_HASH_P0, XF_HASH_P1, XF_HASH_P2, XF_HASH_P3
+	};
+	uint64_t acc[8], secret[8];
+	size_t stripes = (len - 1) / XF_HASH_STRIPE, n;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		secret[i] = lane[i & 3] ^ (seed * (2 * i + 1));
+		acc[i] = lane[(i + 1) & 3];
+	}
+	for (; stripes; stripes -= n, p += n * XF_HASH_STRIPE) {
+		n = stripes < XF_HASH_BLOCK ? stripes : XF_HASH_BLOCK;
+		xf_hash_accum(acc, p, n, secret);
+		if (n < XF_HASH_BLOCK)
+			continue;
+		for (i = 0; i < 8; i++) { /* scramble */
+			acc[i] ^= acc[i] >> 47;
+			acc[i] ^= secret[7 - i];
+			acc[i] *= 0x9e3779b1u;
+		}
+	}
+	/* the last, possibly overlapping stripe */
+	xf_hash_accum(acc, p + ((len - 1) % XF_HASH_STRIPE + 1)
+			- XF_HASH_STRIPE, 1, secret);
+
+	uint64_t h = len * XF_HASH_P0 ^ seed;
+	for (i = 0; i < 8; i += 2)
+		h += xf_hash_mix(acc[i] ^ secret[i], acc[i + 1] ^ secret[i + 1]);
+	return xf_hash_mix(h ^ XF_HASH_P1, h ^ XF_HASH_P3);
+}
+
+XFFNC uint64_t xf_hash_wy64(const void *key, size_t len, uint64_t seed)
+{
+	const uint8_t *p = key;
+	uint64_t a, b;
+
+	seed ^= xf_hash_mix(seed ^ XF_HASH_P0, XF_HASH_P1);
+	if (len <= 16) {
+		if (len >= 4) {
+			a = (xf_hash_r4(p) << 32)
+				| xf_hash_r4(p + ((len >> 3) << 2));
+			b = (xf_hash_r4(p + len - 4) << 32)
+				| xf_hash_r4(p + len - 4 - ((len >> 3) << 2));
+		} else if (len > 0) {
+			a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8)
+				| p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else if (len > XF_HASH_LONG) {
+		return xf_hash_long(p, len, seed);
+	} else {
+		size_t i = len;
+		if (i > 48) {
+			uint64_t s1 = seed, s2 = seed;
+			do {
+				seed = xf_hash_mix(xf_hash_r8(p) ^ XF_HASH_P1,
+						xf_hash_r8(p + 8) ^ seed);
+				s1 = xf_hash_mix(xf_hash_r8(p + 16) ^ XF_HASH_P2,
+						xf_hash_r8(p + 24) ^ s1);
+				s2 = xf_hash_mix(xf_hash_r8(p + 32) ^ XF_HASH_P3,
+						xf_hash_r8(p + 40) ^ s2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= s1 ^ s2;
+		}
+		while (i > 16) {
+			seed = xf_hash_mix(xf_hash_r8(p) ^ XF_HASH_P1,
+					xf_hash_r8(p + 8) ^ seed);
+			p += 16;
+			i -= 16;
+		}
+		a = xf_hash_r8(p + i - 16);
+		b = xf_hash_r8(p + i - 8);
+	}
+	a ^= XF_HASH_P1;
+	b ^= seed;
+	xf_hash_mum(&a, &b);
+	return xf_hash_mix(a ^ XF_HASH_P0 ^ len, b ^ XF_HASH_P1);
+}
+
+XFFNC uint32_t xf_hash_wy32(const char *key, int len)
+{
+	uint64_t h = xf_hash_wy64(key, len, 0);
+	return (uint32_t) (h ^ (h >> 32));
+}
@@ -5,15 +5,24 @@
  * By convention, functions which report integer errors, return 0 on
  * success.
  *
- * Important note: keys are not copied!!
+ * Important note: keys are not copied!! Unless xf_htable_own_keys() is
+ * called, keys longer than %XF_HTABLE_KEY_DIRECT_MAX are stored by pointer.
+ *
+ * To externally share these functions between units (as non-static), define
+ * %_XF_STATIC 0 before including the header and separately compile
+ * xf-htable.c and xf-mregion.c.
  */
 #ifndef _XF_HTABLE_H
-#define _XF_HTABLE_H 00,02,11
+#define _XF_HTABLE_H 00,03,00
 
 #include <stddef.h> // offsetof
 #include <stdint.h> // uintN_t
+#include <stdlib.h> // calloc free, for XF_HTABLE_DEFINE
+
+#include "xf-mregion.h"
 
-/* #define _XF_STATIC 0 to use these as external functions */
+/* #define _XF_STATIC 0 to use these as external functions (and link
+ * xf-htable.c and xf-mregion.c) */
 #ifndef _XF_STATIC // Whether library should "#include" function bodies
 #define XFSTATIC 1
 #else
@@ -26,6 +35,12 @@
 #define XFNOWRN
 #endif
 
+#if __GNUC__ /* Alignment of structure members */
+#define XFALIGN(n) __attribute__((aligned(n)))
+#else
+#define XFALIGN(n)
+#endif
+
 #ifdef _XF_FNC_DECLR /* The flags embedded in function declaration */
 #define XFFNC XFNOWRN _XF_FNC_DECLR
 #elif XFSTATIC == 1
@@ -39,6 +54,81 @@
 	oldsize * 2
 #endif
 
+/* new size of a bucket after removal, return @size to keep it as is */
+#ifndef XF_HTABLE_SHRINKFNC
+#define XF_HTABLE_SHRINKFNC(size, length) \
+	((length) * 4 <= (size) ? (size) / 2 : (size))
+#endif
+
+/* keys xf_htable_find_many() takes through each stage at a time */
+#ifndef XF_HTABLE_BATCH
+#define XF_HTABLE_BATCH 32
+#endif
+
+#if __GNUC__
+#define XF_HTABLE_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define XF_HTABLE_PREFETCH(addr) ((void) (addr))
+#endif
+
+/* lock stripes of struct xf_htable_sync, a power of two */
+#ifndef XF_HTABLE_SYNC_STRIPES
+#define XF_HTABLE_SYNC_STRIPES 64
+#endif
+
+/* reader counter slots of struct xf_htable_sync, threads share them */
+#ifndef XF_HTABLE_SYNC_SLOTS
+#define XF_HTABLE_SYNC_SLOTS 64
+#endif
+
+/* replaced buckets and keys to gather before freeing them */
+#ifndef XF_HTABLE_SYNC_RETIRE
+#define XF_HTABLE_SYNC_RETIRE 64
+#endif
+
+/* xf_htable_add_many() doesn't presize buckets for a batch of fewer keys
+ * than buckets / this */
+#ifndef XF_HTABLE_BULK_SPARSE
+#define XF_HTABLE_BULK_SPARSE 16
+#endif
+
+/* default &xf_htable.max_load, average entries per bucket before growing */
+#ifndef XF_HTABLE_MAXLOAD
+#define XF_HTABLE_MAXLOAD 2
+#endif
+
+/* old buckets moved over to the grown bucket list per add/see/remove */
+#ifndef XF_HTABLE_MIGRATE
+#define XF_HTABLE_MIGRATE 2
+#endif
+
+#ifndef XF_HTABLE_COUNTERS
+/**
+ * XF_HTABLE_COUNTERS - whether to count lookups and bucket reallocations
+ *
+ * Define as 1 before including the header (and, if shared, when compiling
+ * xf-htable.c) to have every table keep a &struct xf_htable_counters in
+ * @counters. As this changes the layout of &struct xf_htable, all of the
+ * units sharing tables have to agree on it. Defaults to 0, in which case
+ * neither the member nor any of the counting is compiled in.
+ */
+#define XF_HTABLE_COUNTERS 0
+#endif
+
+/* bins in &struct xf_htable_stats.hist */
+#define XF_HTABLE_STATS_HIST 16
+
+#ifndef XF_HTABLE_FILE
+/**
+ * XF_HTABLE_FILE - whether to provide saving tables to mappable files
+ *
+ * Define as 1 before including the header to get xf_htable_save() and
+ * xf_htable_open_mapped(). Requires <sys/mman.h> and <fcntl.h>, thus
+ * defaults to 0.
+ */
+#define XF_HTABLE_FILE 0
+#endif
+
 /**
  * enum - special function return values
  * @XF_HTABLE_ESUCCESS:	function returned successfully
@@ -107,11 +197,14 @@ union xf_htable_key {
  * struct xf_htable_bucket - a array of key/value pairs
  * @length:	total members in @data
  * @size:	maximum members @data can hold
- * @data:	bytes holding an array for keys (offset 0) and an array for
- *		values (offset @size * sizeof() &union xf_htable_key )
+ * @data:	bytes holding an array for keys (offset 0), an array for
+ *		values (offset @size * sizeof() &union xf_htable_key ) and an
+ *		array of the keys' hashes after the values
  *
  * Values are stored in an array after @data, use the function
- * xf_htable_bucket_val() to retrieve them.
+ * xf_htable_bucket_val() to retrieve them. The hashes, use
+ * xf_htable_bucket_hash(), let lookups skip most keys without touching
+ * them and let the keys be redistributed without hashing them again.
  */
 struct xf_htable_bucket {
 	unsigned short length;
@@ -119,14 +212,128 @@ struct xf_htable_bucket {
 	union xf_htable_key data[];
 };
 
+/**
+ * struct xf_htable_entry - an entry in the dense array of a table
+ * @key:	the key as it is stored in buckets
+ * @hash:	hash of @key
+ * @dead:	nonzero once the entry has been removed
+ *
+ * The value follows the structure, so it starts at
+ * sizeof() &struct xf_htable_entry from the entry.
+ */
+struct xf_htable_entry {
+	union xf_htable_key key;
+	uint32_t hash;
+	uint32_t dead;
+};
+
+/**
+ * struct xf_htable_dense - entries of a table in insertion order
+ * @entries:	array of @size entries of @entry_size bytes
+ * @value_size:	size of the values as given to xf_htable_construct()
+ * @entry_size:	bytes per entry: a &struct xf_htable_entry and the value,
+ *		padded to keep the next entry aligned
+ * @length:	entries used in @entries, including dead ones
+ * @size:	entries @entries can hold
+ * @dead:	removed entries still taking up space in @entries
+ *
+ * Buckets hold the position of the entry in @entries as their value.
+ * Removed entries are marked dead and left in place so that the order is
+ * kept, until they make up half of @entries and the rest are moved down.
+ */
+struct xf_htable_dense {
+	char *entries;
+	size_t value_size;
+	size_t entry_size;
+	size_t length;
+	size_t size;
+	size_t dead;
+};
+
+/**
+ * struct xf_htable_counters - running counts of a table's operations
+ * @lookups:	keys looked up by xf_htable_find(), xf_htable_find_many(),
+ *		xf_htable_verify(), their _hashed variants and
+ *		xf_htable_sync_find()
+ * @hits:	how many of @lookups found their key
+ * @reallocs:	buckets allocated, grown or shrunk, for a shared table each
+ *		copy a writer makes of a bucket
+ *
+ * Kept from xf_htable_construct() on, xf_htable_clear() doesn't reset
+ * them. Tables shared through &struct xf_htable_sync count with relaxed
+ * atomics, so reading the counters while threads use the table gives a
+ * recent but not necessarily consistent snapshot.
+ */
+struct xf_htable_counters {
+	size_t lookups;
+	size_t hits;
+	size_t reallocs;
+};
+
+/**
+ * struct xf_htable_stats - how well the entries of a table are spread
+ * @buckets:	buckets in the table, those still to be migrated included
+ * @empty:	buckets without entries
+ * @hist:	buckets by length, @hist[i] counts the buckets holding i
+ *		entries and the last bin all the longer ones
+ * @hit_max:	the most hashes compared to find a key that is in the table
+ * @hit_mean:	hashes compared to find a key, averaged over the entries
+ * @miss_max:	the most hashes compared to find a key isn't in the table
+ * @miss_mean:	hashes compared for a key that isn't in the table, averaged
+ *		over all hash values
+ * @direct:	entries with keys stored in the bucket
+ * @indirect:	entries with keys stored by pointer
+ * @slots:	entries the allocated buckets can hold
+ * @wasted:	@slots left unused, the sum of size - length over buckets
+ *
+ * Filled by xf_htable_stats(). Long scans with a sensible @hist point to a
+ * table too small for its entries, a @hist with many empty and some very
+ * long buckets to a poor hash function or skewed keys.
+ */
+struct xf_htable_stats {
+	size_t buckets;
+	size_t empty;
+	size_t hist[XF_HTABLE_STATS_HIST];
+	size_t hit_max;
+	double hit_mean;
+	size_t miss_max;
+	double miss_mean;
+	size_t direct;
+	size_t indirect;
+	size_t slots;
+	size_t wasted;
+};
+
 /**
  * struct xf_htable - instance of hash-table
- * @hash:	hash function used for distributing the data
+ * @hash:	hash function used for distributing the data, %NULL if @hash64
+ *		is used instead
+ * @hash64:	seeded 64-bit hash function used if @hash is %NULL
+ * @seed:	seed passed to @hash64
  * @res_mask:	mask to bitwise AND out high bits to get a bucket's index;
  *		@res_mask + 1 to get amount of buckets
- * @value_size:	how many bytes does a single value take up
+ * @value_size:	how many bytes does a single value in a bucket take up,
+ *		in dense mode that is the size of a position in @dense
  * @buckets:	list of buckets, a bucket slot may be %NULL if no entry has yet
  *		been associated with it
+ * @count:	entries in the table
+ * @max_load:	once @count reaches @max_load times the amount of buckets, the
+ *		bucket list is doubled, 0 to keep the size given to
+ *		xf_htable_construct()
+ * @old_buckets:	the list of buckets before the last growth or %NULL
+ *		once all of its entries have been moved to @buckets
+ * @old_mask:	@res_mask of @old_buckets
+ * @migrate:	index of the next bucket in @old_buckets to move over
+ * @keys:	region long keys are copied to, %NULL if the table doesn't own
+ *		its keys
+ * @dense:	the entries in insertion order if xf_htable_use_dense() was
+ *		called, %NULL otherwise
+ * @counters:	operation counts, only if %XF_HTABLE_COUNTERS
+ *
+ * Growing the table doesn't move all the entries at once. Instead every
+ * xf_htable_add(), xf_htable_see() and xf_htable_remove() moves the old
+ * bucket of the key it was given and %XF_HTABLE_MIGRATE others, which is
+ * enough to be done before the table needs to grow again.
  *
  * Limitations:
  *	Each bucket can maximally hold %USHRT_MAX entries.
@@ -137,9 +344,37 @@ struct xf_htable_bucket {
 struct xf_htable
 {
 	uint32_t (*hash)(const char *key, int len);
+	uint64_t (*hash64)(const void *key, size_t len, uint64_t seed);
+	uint64_t seed;
 	uint32_t res_mask;
 	size_t value_size;
 	struct xf_htable_bucket **buckets;
+	size_t count;
+	unsigned int max_load;
+	struct xf_htable_bucket **old_buckets;
+	uint32_t old_mask;
+	size_t migrate;
+	struct xf_mregion *keys;
+	struct xf_htable_dense *dense;
+#if XF_HTABLE_COUNTERS
+	struct xf_htable_counters counters;
+#endif
+};
+
+/**
+ * struct xf_htable_iter - position of an iteration over a table
+ * @t:		the table
+ * @pos:	index of the current bucket or dense entry
+ * @index:	index of the next entry in the current bucket
+ * @old:	whether @pos refers to @t->old_buckets
+ *
+ * See xf_htable_iter_init().
+ */
+struct xf_htable_iter {
+	struct xf_htable *t;
+	size_t pos;
+	int index;
+	int old;
 };
 
 /**
@@ -158,11 +393,27 @@ static inline void *xf_htable_bucket_val(struct xf_htable *tbl,
 
 }
 
+/**
+ * xf_htable_bucket_hash() - access the stored hashes of given bucket's keys
+ * @tbl:	the hashtable the bucket's in
+ * @b:		bucket to get the hashes of
+ *
+ * Return:	pointer to an array of @b->size hashes, one per key
+ */
+static inline uint32_t *xf_htable_bucket_hash(struct xf_htable *tbl,
+		struct xf_htable_bucket *b)
+{
+	size_t off = (sizeof(union xf_htable_key) + tbl->value_size) * b->size;
+	off = (off + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+	return (uint32_t *) (((uint8_t *)&b->data[0]) + off);
+}
+
 /**
  * xf_htable_construct() - initialize an instance of struct xf_htable
  * @t:		instance to initialize
- * @size_bits:	how many bits to use for bucket IDs;
+ * @size_bits:	how many bits to use for bucket IDs initially;
  *		2^@size_bits = how many buckets to distribute the load over
+ *		until the table grows
  * @value_size:	the byte-size of data you wish to associate with the keys
  * @hash:	the hash function used to select a  bucket, write/find your
  *		own or use one of xf_hash_*
@@ -180,6 +431,61 @@ static inline void *xf_htable_bucket_val(struct xf_htable *tbl,
 XFFNC void xf_htable_construct(struct xf_htable *t, unsigned int size_bits,
 		size_t value_size, uint32_t (*hash)(const char *,int));
 
+/**
+ * xf_htable_construct64() - initialize a table using a seeded 64-bit hash
+ * @t:		instance to initialize
+ * @size_bits:	see xf_htable_construct()
+ * @value_size:	the byte-size of data you wish to associate with the keys
+ * @hash64:	the hash function, for example xf_hash_wy64()
+ * @seed:	seed for @hash64, a random one makes the distribution of keys
+ *		over buckets unpredictable from outside
+ *
+ * Only 32 bits of the hash are stored with each key, as the amount of
+ * buckets is capped to 2^32 anyway; the upper half is folded into them.
+ */
+XFFNC void xf_htable_construct64(struct xf_htable *t, unsigned int size_bits,
+		size_t value_size,
+		uint64_t (*hash64)(const void *, size_t, uint64_t),
+		uint64_t seed);
+
+/**
+ * xf_htable_own_keys() - make the table keep copies of the keys added to it
+ * @t:		table, constructed and still empty
+ * @initsize:	initial size of the region for the keys, 0 for default
+ *
+ * Keys longer than %XF_HTABLE_KEY_DIRECT_MAX are then copied one after
+ * another into a region that belongs to the table, so callers needn't
+ * keep them around and lookups compare against keys packed close to each
+ * other. The copies are freed all at once by xf_htable_clear() and
+ * xf_htable_destruct(); removing an entry only gives its key's memory back
+ * if it was the last one copied.
+ */
+XFFNC void xf_htable_own_keys(struct xf_htable *t, size_t initsize);
+
+/**
+ * xf_htable_use_dense() - keep the entries in one insertion ordered array
+ * @t:		table, constructed and still empty
+ *
+ * The keys and values are then appended to @t->dense as they're added,
+ * while the buckets only point into it. Iterating walks the array in the
+ * order the entries were added, without visiting any buckets. Lookups
+ * take one more step to get from the bucket to the value.
+ */
+XFFNC void xf_htable_use_dense(struct xf_htable *t);
+
+/**
+ * xf_htable_reserve() - make room for a number of entries up front
+ * @t:		the table
+ * @n:		entries the table is going to hold
+ *
+ * Finishes moving entries if the table is growing and grows the bucket
+ * list straight to the size @n entries would take it to, moving all the
+ * entries at once into buckets allocated at their final size. Adding up
+ * to @n entries afterwards won't grow the bucket list. Tables with a
+ * &xf_htable.max_load of 0 only have their dense array enlarged.
+ */
+XFFNC void xf_htable_reserve(struct xf_htable *t, size_t n);
+
 /**
  * xf_htable_memcnt() - count dynamically allocated memory associated with htable
  * @t:		table which's memory to count
@@ -188,6 +494,17 @@ XFFNC void xf_htable_construct(struct xf_htable *t, unsigned int size_bits,
  */
 XFFNC size_t xf_htable_memcnt(struct xf_htable *t);
 
+/**
+ * xf_htable_stats() - measure how the entries of a table are distributed
+ * @t:		the table
+ * @st:		where to write the statistics
+ *
+ * Walks every bucket, so it takes about as long as iterating the table.
+ * Hashes compared are counted the way xf_htable_find() scans: first the
+ * current bucket, then the old one if the table is growing.
+ */
+XFFNC void xf_htable_stats(struct xf_htable *t, struct xf_htable_stats *st);
+
 /**
  * xf_htable_destruct() - releases all associated memory allocated to htable
  * @t:		the hashtable no longer required
@@ -214,6 +531,30 @@ XFFNC void xf_htable_clear(struct xf_htable *t);
 XFFNC int xf_htable_add(struct xf_htable *t, const void *key, size_t keylen,
 		const void *value);
 
+/**
+ * xf_htable_add_many() - insert many key/value pairs at once
+ * @t:		the table
+ * @n:		amount of pairs
+ * @keys:	the keys
+ * @keylens:	lengths of @keys
+ * @values:	@n values back to back, each taking up the value size given
+ *		to xf_htable_construct()
+ *
+ * Calls xf_htable_reserve() for the new keys, hashes all of them and
+ * counts them per bucket, then allocates or enlarges each bucket once to
+ * its final size before the pairs are added. Filling a table this way
+ * avoids the reallocations buckets go through while growing one entry at
+ * a time. Batches too small for the table to be worth counting, see
+ * %XF_HTABLE_BULK_SPARSE, are added one by one after the reserve. Keys
+ * already in the table keep their value, as with xf_htable_add(); of keys
+ * given twice the first one is added.
+ *
+ * Return:	how many of the pairs were added
+ */
+XFFNC size_t xf_htable_add_many(struct xf_htable *t, size_t n,
+		const void *const *keys, const size_t *keylens,
+		const void *values);
+
 /**
  * xf_htable_see() - see to that given key is in the table
  * @t:		hashtable to look in
@@ -244,6 +585,26 @@ XFFNC void *xf_htable_see(struct xf_htable *t, const void *key, size_t keylen,
  */
 XFFNC void *xf_htable_find(struct xf_htable *t, const void *key, size_t keylen);
 
+/**
+ * xf_htable_find_many() - look up the values of many keys at once
+ * @t:		hashtable to look in
+ * @n:		amount of keys
+ * @keys:	the keys to search for
+ * @keylens:	lengths of @keys
+ * @values:	where to write the pointer to the value of each key or %NULL,
+ *		see xf_htable_find()
+ *
+ * Keys are taken %XF_HTABLE_BATCH at a time: all of them are hashed,
+ * then their bucket pointers, buckets and hashes in the buckets are
+ * prefetched stage by stage before any is compared. This way the cache
+ * misses of different keys are waited on together instead of one by one,
+ * which pays off on tables much larger than the cpu caches.
+ *
+ * Return:	how many of the keys were found
+ */
+XFFNC size_t xf_htable_find_many(struct xf_htable *t, size_t n,
+		const void *const *keys, const size_t *keylens, void **values);
+
 /**
  * xf_htable_verify() - verify that a key/value pair exists in table
  * @t:		hashtable to look in
@@ -276,6 +637,357 @@ XFFNC int xf_htable_verify(struct xf_htable *t, const void *key, size_t keylen,
 XFFNC int xf_htable_remove(struct xf_htable *t, const void *key,
 		size_t keylen);
 
+/**
+ * xf_htable_hash() - hash a key the way a table does
+ * @t:		the table
+ * @key:	key to hash
+ * @keylen:	length of @key
+ *
+ * The result can be passed to the *_hashed functions of any table using
+ * the same hash function and seed, saving them hashing the key again.
+ *
+ * Return:	the hash of @key as used and stored by @t
+ */
+XFFNC uint32_t xf_htable_hash(struct xf_htable *t, const void *key,
+		size_t keylen);
+
+/**
+ * xf_htable_add_hashed() - xf_htable_add() with a precomputed hash
+ * @t:		the table
+ * @hash:	xf_htable_hash() of @key
+ * @key:	the key
+ * @keylen:	length of @key
+ * @value:	the value
+ *
+ * Return:	same as xf_htable_add()
+ */
+XFFNC int xf_htable_add_hashed(struct xf_htable *t, uint32_t hash,
+		const void *key, size_t keylen, const void *value);
+
+/**
+ * xf_htable_see_hashed() - xf_htable_see() with a precomputed hash
+ * @t:		the table
+ * @hash:	xf_htable_hash() of @key
+ * @key:	the key
+ * @keylen:	length of @key
+ * @value_def:	value for a new entry or %NULL
+ *
+ * Return:	same as xf_htable_see()
+ */
+XFFNC void *xf_htable_see_hashed(struct xf_htable *t, uint32_t hash,
+		const void *key, size_t keylen, const void *value_def);
+
+/**
+ * xf_htable_find_hashed() - xf_htable_find() with a precomputed hash
+ * @t:		the table
+ * @hash:	xf_htable_hash() of @key
+ * @key:	key to search for
+ * @keylen:	length of @key
+ *
+ * Return:	same as xf_htable_find()
+ */
+XFFNC void *xf_htable_find_hashed(struct xf_htable *t, uint32_t hash,
+		const void *key, size_t keylen);
+
+/**
+ * xf_htable_verify_hashed() - xf_htable_verify() with a precomputed hash
+ * @t:		the table
+ * @hash:	xf_htable_hash() of @key
+ * @key:	key to search for
+ * @keylen:	length of @key
+ * @value:	the value to match
+ *
+ * Return:	same as xf_htable_verify()
+ */
+XFFNC int xf_htable_verify_hashed(struct xf_htable *t, uint32_t hash,
+		const void *key, size_t keylen, const void *value);
+
+/**
+ * xf_htable_remove_hashed() - xf_htable_remove() with a precomputed hash
+ * @t:		the table
+ * @hash:	xf_htable_hash() of @key
+ * @key:	key to remove
+ * @keylen:	length of @key
+ *
+ * Return:	same as xf_htable_remove()
+ */
+XFFNC int xf_htable_remove_hashed(struct xf_htable *t, uint32_t hash,
+		const void *key, size_t keylen);
+
+/**
+ * xf_htable_iter_init() - start iterating over the entries of a table
+ * @it:		iterator to initialize
+ * @t:		table to iterate over
+ *
+ * Iterate with xf_htable_iter_next(). While iterating, values may be
+ * modified but no entries added or removed. Dense tables are iterated in
+ * the order entries were added, others in no particular order.
+ */
+XFFNC void xf_htable_iter_init(struct xf_htable_iter *it, struct xf_htable *t);
+
+/**
+ * xf_htable_iter_next() - get the next entry of an iteration
+ * @it:		iterator set up with xf_htable_iter_init()
+ * @key:	where to write a pointer to the entry's key, or %NULL
+ * @keylen:	where to write the length of the key, or %NULL
+ *
+ * Return:	pointer to the value of the entry or %NULL if there are no
+ *		more entries
+ */
+XFFNC void *xf_htable_iter_next(struct xf_htable_iter *it, const void **key,
+		size_t *keylen);
+
+#if XF_HTABLE_FILE
+#define XF_HTABLE_FILE_MAGIC "xfhtabl"
+#define XF_HTABLE_FILE_VERSION 1
+
+/**
+ * struct xf_htable_image - header at the beginning of a saved table
+ * @magic:	%XF_HTABLE_FILE_MAGIC, '\0' terminated
+ * @version:	%XF_HTABLE_FILE_VERSION
+ * @value_size:	size of each value
+ * @res_mask:	&xf_htable.res_mask of the saved table
+ * @hash64:	whether the table hashed with &xf_htable.hash64
+ * @seed:	&xf_htable.seed of the saved table
+ * @count:	entries in the file
+ * @length:	size of the file
+ * @index:	offset of @res_mask + 2 uint64_t, entries of bucket i are
+ *		those from index[i] up to index[i + 1]
+ * @entries:	offset of @count &struct xf_htable_image_entry
+ * @values:	offset of @count values, in the order of @entries
+ * @keys:	offset of the keys too long to be stored in the entries
+ *
+ * All of the offsets are from the beginning of the file, so it can be
+ * mapped anywhere. Numbers are stored in the byte order of the machine
+ * that saved the table.
+ */
+struct xf_htable_image {
+	char magic[8];
+	uint32_t version;
+	uint32_t value_size;
+	uint32_t res_mask;
+	uint32_t hash64;
+	uint64_t seed;
+	uint64_t count;
+	uint64_t length;
+	uint64_t index;
+	uint64_t entries;
+	uint64_t values;
+	uint64_t keys;
+};
+
+/**
+ * struct xf_htable_image_entry - a key in a saved table
+ * @hash:	hash of the key
+ * @length:	length of the key
+ * @key:	the key itself if @length is 8 or less, its offset from
+ *		&xf_htable_image.keys otherwise
+ */
+struct xf_htable_image_entry {
+	uint32_t hash;
+	uint32_t length;
+	union {
+		uint8_t a[8];
+		uint64_t off;
+	} key;
+};
+
+/**
+ * struct xf_htable_mapped - a saved table mapped for lookups
+ * @img:	the mapping
+ * @hash:	hash function, as given to xf_htable_open_mapped()
+ * @hash64:	seeded hash function, as given to xf_htable_open_mapped()
+ */
+struct xf_htable_mapped {
+	const struct xf_htable_image *img;
+	uint32_t (*hash)(const char *key, int len);
+	uint64_t (*hash64)(const void *key, size_t len, uint64_t seed);
+};
+
+/**
+ * xf_htable_save() - write a table to a file
+ * @t:		the table, may be in any of its modes and in the middle of
+ *		growing
+ * @path:	file to write, truncated if it exists
+ *
+ * The file holds copies of all the keys and values, laid out so that
+ * xf_htable_open_mapped() can answer lookups from a read-only mapping of
+ * it without loading or fixing anything up first.
+ *
+ * Return:	0 on success, -1 if @path couldn't be written
+ */
+XFFNC int xf_htable_save(struct xf_htable *t, const char *path);
+
+/**
+ * xf_htable_open_mapped() - map a file written by xf_htable_save()
+ * @m:		where to set up the mapped table
+ * @path:	the file
+ * @hash:	hash function of the saved table or %NULL if it used @hash64
+ * @hash64:	seeded hash function of the saved table, the seed is read
+ *		from the file
+ *
+ * The hash function cannot be stored in the file, so it has to be given
+ * again; the first key in the file is hashed to check that it is the
+ * same one. The bucket index and the key offsets are all checked to stay
+ * within the file, which takes time linear in the entries but keeps a
+ * damaged file from making lookups read out of bounds.
+ *
+ * Return:	0 on success, -1 if @path couldn't be mapped, isn't a saved
+ *		table, is damaged or was saved with another hash function
+ */
+XFFNC int xf_htable_open_mapped(struct xf_htable_mapped *m, const char *path,
+		uint32_t (*hash)(const char *, int),
+		uint64_t (*hash64)(const void *, size_t, uint64_t));
+
+/**
+ * xf_htable_mapped_find() - xf_htable_find() for a mapped table
+ * @m:		the mapped table
+ * @key:	key to search for
+ * @keylen:	length of @key
+ *
+ * Return:	%NULL or a pointer to the value in the mapping
+ */
+XFFNC const void *xf_htable_mapped_find(const struct xf_htable_mapped *m,
+		const void *key, size_t keylen);
+
+/**
+ * xf_htable_mapped_verify() - xf_htable_verify() for a mapped table
+ * @m:		the mapped table
+ * @key:	key to search for
+ * @keylen:	length of @key
+ * @value:	the value to match
+ *
+ * Return:	same as xf_htable_verify()
+ */
+XFFNC int xf_htable_mapped_verify(const struct xf_htable_mapped *m,
+		const void *key, size_t keylen, const void *value);
+
+/**
+ * xf_htable_mapped_close() - unmap a table mapped by xf_htable_open_mapped()
+ * @m:		the mapped table
+ */
+XFFNC void xf_htable_mapped_close(struct xf_htable_mapped *m);
+#endif
+
+#if __GNUC__
+/**
+ * struct xf_htable_stripe - lock of a set of buckets of a shared table
+ * @seq:	odd while a writer is changing one of the buckets
+ * @lock:	taken by writers
+ */
+struct xf_htable_stripe {
+	unsigned int seq;
+	char lock;
+} XFALIGN(64);
+
+/**
+ * struct xf_htable_epoch - count of readers in a shared table
+ * @count:	readers that entered in an even and an odd epoch
+ */
+struct xf_htable_epoch {
+	unsigned long count[2];
+} XFALIGN(64);
+
+/**
+ * struct xf_htable_sync - hash-table shared between threads
+ * @t:		the table, not to be used directly
+ * @stripes:	%XF_HTABLE_SYNC_STRIPES locks, bucket i belongs to stripe
+ *		i % %XF_HTABLE_SYNC_STRIPES
+ * @epoch:	advanced each time retired memory is freed
+ * @slots:	%XF_HTABLE_SYNC_SLOTS reader counters
+ * @retired:	buckets and keys replaced or removed by writers, which
+ *		readers might still be looking at
+ * @retired_len:	entries in @retired
+ * @retire_lock:	taken to add to @retired or free it
+ *
+ * Readers take no locks. Writers lock the stripe of the bucket they
+ * change, and never change the keys of a bucket in place: a bucket is
+ * replaced by a copy when it needs to grow or lose an entry, and the old
+ * one kept until no reader can still be using it. Readers check the
+ * stripe's @seq before and after copying a value out and retry if it
+ * changed, so they never see a value half written.
+ *
+ * The table has a fixed amount of buckets; growth, dense mode and
+ * xf_htable_own_keys() are not supported. Keys longer than
+ * %XF_HTABLE_KEY_DIRECT_MAX are always copied, so they can be kept until
+ * readers are done with them.
+ */
+struct xf_htable_sync {
+	struct xf_htable t;
+	struct xf_htable_stripe *stripes;
+	unsigned long epoch;
+	struct xf_htable_epoch *slots;
+	void *retired[XF_HTABLE_SYNC_RETIRE];
+	size_t retired_len;
+	char retire_lock;
+};
+
+/**
+ * xf_htable_sync_construct() - initialize a table shared between threads
+ * @s:		instance to initialize
+ * @size_bits:	2^@size_bits = amount of buckets, which stays fixed
+ * @value_size:	the byte-size of data you wish to associate with the keys
+ * @hash:	the hash function, see xf_htable_construct()
+ */
+XFFNC void xf_htable_sync_construct(struct xf_htable_sync *s,
+		unsigned int size_bits, size_t value_size,
+		uint32_t (*hash)(const char *,int));
+
+/**
+ * xf_htable_sync_destruct() - release all memory of a shared table
+ * @s:		the table, no longer used by any thread
+ */
+XFFNC void xf_htable_sync_destruct(struct xf_htable_sync *s);
+
+/**
+ * xf_htable_sync_add() - add a key/value pair to a shared table
+ * @s:		the table
+ * @key:	the key, copied if long
+ * @keylen:	length of @key
+ * @value:	value to copy into the table
+ *
+ * Return:	%XF_HTABLE_ESUCCESS, %XF_HTABLE_ESET if the key is already in
+ *		the table and %XF_HTABLE_EFULL if its bucket can't hold more
+ */
+XFFNC int xf_htable_sync_add(struct xf_htable_sync *s, const void *key,
+		size_t keylen, const void *value);
+
+/**
+ * xf_htable_sync_set() - add a key/value pair or overwrite the value
+ * @s:		the table
+ * @key:	the key, copied if long
+ * @keylen:	length of @key
+ * @value:	value to copy into the table
+ *
+ * Return:	%XF_HTABLE_ESUCCESS or %XF_HTABLE_EFULL
+ */
+XFFNC int xf_htable_sync_set(struct xf_htable_sync *s, const void *key,
+		size_t keylen, const void *value);
+
+/**
+ * xf_htable_sync_find() - look up a key in a shared table without locking
+ * @s:		the table
+ * @key:	key to search for
+ * @keylen:	length of @key
+ * @value:	where to copy the value to, or %NULL
+ *
+ * Return:	%XF_HTABLE_ESUCCESS or %XF_HTABLE_ENOTFOUND
+ */
+XFFNC int xf_htable_sync_find(struct xf_htable_sync *s, const void *key,
+		size_t keylen, void *value);
+
+/**
+ * xf_htable_sync_remove() - remove a key from a shared table
+ * @s:		the table
+ * @key:	key to remove
+ * @keylen:	length of @key
+ *
+ * Return:	%XF_HTABLE_ESUCCESS or %XF_HTABLE_ENOTFOUND
+ */
+XFFNC int xf_htable_sync_remove(struct xf_htable_sync *s, const void *key,
+		size_t keylen);
+#endif
+
 /**
  * xf_hash_jenkins_oaat() - Bob Jenkins' One-at-a-Time hash
  * @key:	key to hash
@@ -294,6 +1006,219 @@ XFFNC uint32_t xf_hash_jenkins_oaat(const char *key, int len);
  */
 XFFNC uint32_t xf_hash_hsieh_superfast(const char *data, int len);
 
+/**
+ * xf_hash_wy64() - seeded 64-bit hash
+ * @key:	key to hash
+ * @len:	length of @key
+ * @seed:	any value, different seeds give unrelated hashes
+ *
+ * Keys up to 256 bytes are hashed wyhash style, 16 or 48 bytes at a time
+ * with 64x64->128 bit multiplies. Longer keys go through 8 lanes of xxh3
+ * style accumulators that are run with AVX2 or SSE2 when the cpu supports
+ * them, which is picked once at startup. All paths give the same result.
+ *
+ * Sources: https://github.com/wangyi-fudan/wyhash
+ *	https://github.com/Cyan4973/xxHash
+ */
+XFFNC uint64_t xf_hash_wy64(const void *key, size_t len, uint64_t seed);
+
+/**
+ * xf_hash_wy32() - xf_hash_wy64() with seed 0, folded to 32 bits
+ * @key:	key to hash
+ * @len:	length of the @key
+ *
+ * Fits in where the 32-bit hashes above do, such as xf_htable_construct().
+ */
+XFFNC uint32_t xf_hash_wy32(const char *key, int len);
+
+/**
+ * xf_hash_u64() - mix the bits of an integer key
+ * @x:		the key
+ *
+ * The finalizer of MurmurHash3's 64-bit variant, for use as @hashfn of
+ * XF_HTABLE_DEFINE() with integer keys.
+ */
+static inline uint64_t xf_hash_u64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdull;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ull;
+	x ^= x >> 33;
+	return x;
+}
+
+/* @eqfn of XF_HTABLE_DEFINE() for keys comparable with == */
+#define XF_HTABLE_EQ(a, b) ((a) == (b))
+
+/**
+ * XF_HTABLE_DEFINE() - define a hash-table specialized for given types
+ * @name:	prefix of the generated struct and functions
+ * @key_t:	type of the keys, copied by assignment
+ * @val_t:	type of the values, copied by assignment
+ * @hashfn:	function or macro taking a @key_t and giving an integer hash,
+ *		such as xf_hash_u64()
+ * @eqfn:	function or macro taking two @key_t and telling whether they're
+ *		equal, such as XF_HTABLE_EQ()
+ *
+ * Generates struct @name with static inline functions that inline @hashfn
+ * and @eqfn, so lookups go through no function pointers, memcmp() or
+ * runtime value sizes. The keys and values are kept side by side in one
+ * array of struct @name_entry, probed linearly from the slot the hash
+ * selects. The array doubles once it is 3/4 full and removal shifts
+ * following entries back, so no deleted markers are left behind.
+ *
+ *	@name_construct(struct @name *t, unsigned int size_bits)
+ *	@name_destruct(struct @name *t)
+ *	@name_clear(struct @name *t)
+ *	@name_memcnt(struct @name *t)
+ *	@name_find(struct @name *t, @key_t key) - pointer to value or %NULL
+ *	@name_add(struct @name *t, @key_t key, @val_t value) -
+ *		%XF_HTABLE_ESUCCESS or %XF_HTABLE_ESET
+ *	@name_see(struct @name *t, @key_t key, @val_t value_def) - pointer to
+ *		the value, set to @value_def if the key was new
+ *	@name_remove(struct @name *t, @key_t key) - %XF_HTABLE_ESUCCESS or
+ *		%XF_HTABLE_ENOTFOUND
+ *
+ * Value pointers stay valid until the next @name_add, @name_see or
+ * @name_remove.
+ */
+#define XF_HTABLE_DEFINE(name, key_t, val_t, hashfn, eqfn)		\
+struct name##_entry {							\
+	key_t key;							\
+	val_t value;							\
+};									\
+									\
+struct name {								\
+	size_t mask;							\
+	size_t count;							\
+	uint8_t *used;							\
+	struct name##_entry *entries;					\
+};									\
+									\
+static inline void name##_construct(struct name *t,			\
+		unsigned int size_bits)					\
+{									\
+	size_t cap = (size_t) 1 << (size_bits < 2 ? 2 : size_bits);	\
+	t->mask = cap - 1;						\
+	t->count = 0;							\
+	t->used = calloc(cap, 1);					\
+	t->entries = malloc(cap * sizeof(*t->entries));			\
+}									\
+									\
+static inline void name##_destruct(struct name *t)			\
+{									\
+	free(t->used);							\
+	free(t->entries);						\
+}									\
+									\
+static inline void name##_clear(struct name *t)				\
+{									\
+	size_t i;							\
+	for (i = 0; i <= t->mask; i++)					\
+		t->used[i] = 0;						\
+	t->count = 0;							\
+}									\
+									\
+static inline size_t name##_memcnt(struct name *t)			\
+{									\
+	return (t->mask + 1) * (1 + sizeof(*t->entries));		\
+}									\
+									\
+/* slot holding key, or the empty slot ending its probe sequence */	\
+static inline size_t name##_slot(struct name *t, key_t key)		\
+{									\
+	size_t i = (size_t) (hashfn(key)) & t->mask;			\
+	while (t->used[i] && !(eqfn(t->entries[i].key, key)))		\
+		i = (i + 1) & t->mask;					\
+	return i;							\
+}									\
+									\
+static inline void name##_grow(struct name *t)				\
+{									\
+	uint8_t *used = t->used;					\
+	struct name##_entry *entries = t->entries;			\
+	size_t i, cap = t->mask + 1;					\
+	t->mask = cap * 2 - 1;						\
+	t->used = calloc(cap * 2, 1);					\
+	t->entries = malloc(cap * 2 * sizeof(*t->entries));		\
+	for (i = 0; i < cap; i++) {					\
+		if (!used[i])						\
+			continue;					\
+		size_t j = name##_slot(t, entries[i].key);		\
+		t->used[j] = 1;						\
+		t->entries[j] = entries[i];				\
+	}								\
+	free(used);							\
+	free(entries);							\
+}									\
+									\
+static inline val_t *name##_find(struct name *t, key_t key)		\
+{									\
+	size_t i = name##_slot(t, key);					\
+	return t->used[i] ? &t->entries[i].value : NULL;		\
+}									\
+									\
+/* slot for key, inserting it if new; *isnew tells which happened */	\
+static inline size_t name##_get(struct name *t, key_t key, int *isnew)	\
+{									\
+	size_t i = name##_slot(t, key);					\
+	*isnew = !t->used[i];						\
+	if (!*isnew)							\
+		return i;						\
+	if ((t->count + 1) * 4 > (t->mask + 1) * 3) {			\
+		name##_grow(t);						\
+		i = name##_slot(t, key);				\
+	}								\
+	t->used[i] = 1;							\
+	t->entries[i].key = key;					\
+	t->count++;							\
+	return i;							\
+}									\
+									\
+static inline int name##_add(struct name *t, key_t key, val_t value)	\
+{									\
+	int isnew;							\
+	size_t i = name##_get(t, key, &isnew);				\
+	if (!isnew)							\
+		return XF_HTABLE_ESET;					\
+	t->entries[i].value = value;					\
+	return XF_HTABLE_ESUCCESS;					\
+}									\
+									\
+static inline val_t *name##_see(struct name *t, key_t key,		\
+		val_t value_def)					\
+{									\
+	int isnew;							\
+	size_t i = name##_get(t, key, &isnew);				\
+	if (isnew)							\
+		t->entries[i].value = value_def;			\
+	return &t->entries[i].value;					\
+}									\
+									\
+static inline int name##_remove(struct name *t, key_t key)		\
+{									\
+	size_t i = name##_slot(t, key), j = i;				\
+	if (!t->used[i])						\
+		return XF_HTABLE_ENOTFOUND;				\
+	/* move back the following entries that may no longer be	\
+	 * reachable past the hole */					\
+	for (;;) {							\
+		j = (j + 1) & t->mask;					\
+		if (!t->used[j])					\
+			break;						\
+		size_t k = (size_t) (hashfn(t->entries[j].key));	\
+		k &= t->mask;						\
+		if ((j > i && (k <= i || k > j))			\
+				|| (j < i && (k <= i && k > j))) {	\
+			t->entries[i] = t->entries[j];			\
+			i = j;						\
+		}							\
+	}								\
+	t->used[i] = 0;							\
+	t->count--;							\
+	return XF_HTABLE_ESUCCESS;					\
+}
 
 #if XFSTATIC == 1 // Include function bodies?
 #include "xf-htable.c"
@@ -303,6 +1228,7 @@ XFFNC uint32_t xf_hash_hsieh_superfast(const char *data, int len);
 // Clear up some internal «local» definitions
 #undef XFFNC
 #undef XFNOWRN
+#undef XFALIGN
 #undef XFSTATIC
 #endif
 
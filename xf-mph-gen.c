@@ -0,0 +1,151 @@
+/**
+ * DOC: xf-mph-gen.c
+ * Host tool writing out a minimal perfect hash table as C source.
+ *
+ * DOC: README
+ *	xf-mph-gen NAME [VALUE_TYPE] < keys.txt > NAME.h
+ *
+ * Reads one key per line from standard input, lines of up to 4095 bytes.
+ * With VALUE_TYPE given, each line is a key, a tab and a C initializer for
+ * its value. Writes out constant data defining a &struct xf_mph called
+ * NAME, with its keys in NAME_keys and, if VALUE_TYPE was given, the values
+ * in NAME_values, both in slot order:
+ *
+ *	long i = xf_mph_find(&NAME, key, len);
+ *	if (i >= 0)
+ *		use(NAME_values[i]);
+ */
+#include "xf-mph.h"
+
+#include <stdio.h> // fgets getchar printf
+#include <stdlib.h> // malloc realloc exit
+#include <string.h> // strlen strchr memcpy
+
+/* print @len bytes of @s as the inside of a C string literal */
+static void print_str(const char *s, size_t len)
+{
+	size_t i;
+	for (i = 0; i < len; i++) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\')
+			printf("\\%c", c);
+		else if (c >= ' ' && c < 127 && c != '?')
+			putchar(c);
+		else /* octal is always 3 digits, unlike hex escapes */
+			printf("\\%03o", c);
+	}
+}
+
+/* @p, or exit if the allocation that returned it failed */
+static void *check(void *p)
+{
+	if (p == NULL) {
+		fprintf(stderr, "xf-mph-gen: out of memory\n");
+		exit(1);
+	}
+	return p;
+}
+
+/* a copy of the first @len bytes of @s, '\0' terminated */
+static char *copy(const char *s, size_t len)
+{
+	char *c = check(malloc(len + 1));
+	memcpy(c, s, len);
+	c[len] = '\0';
+	return c;
+}
+
+int main(int argc, char **argv)
+{
+	const char *name, *vtype;
+	char line[4096];
+	const void **keys = NULL;
+	size_t *lens = NULL;
+	char **vals = NULL;
+	uint32_t n = 0, size = 0, i;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "usage: %s NAME [VALUE_TYPE] < keys\n", argv[0]);
+		return 2;
+	}
+	name = argv[1];
+	vtype = argc == 3 ? argv[2] : NULL;
+
+	while (fgets(line, sizeof(line), stdin)) {
+		size_t len = strlen(line);
+		if (len && line[len - 1] == '\n') {
+			line[--len] = '\0';
+		} else if (len == sizeof(line) - 1) {
+			/* the rest would be taken for another key */
+			int c = getchar();
+			if (c != '\n' && c != EOF) {
+				fprintf(stderr, "line %u: longer than %zu "
+						"bytes\n", n + 1, len);
+				return 1;
+			}
+		}
+		if (len && line[len - 1] == '\r')
+			line[--len] = '\0';
+		if (n == size) {
+			size = size ? size * 2 : 64;
+			keys = check(realloc(keys, size * sizeof(*keys)));
+			lens = check(realloc(lens, size * sizeof(*lens)));
+			vals = check(realloc(vals, size * sizeof(*vals)));
+		}
+		char *tab = vtype ? strchr(line, '\t') : NULL;
+		if (vtype && tab == NULL) {
+			fprintf(stderr, "line %u: no tab and value\n", n + 1);
+			return 1;
+		}
+		if (tab) {
+			*tab = '\0';
+			len = tab - line;
+			vals[n] = copy(tab + 1, strlen(tab + 1));
+		}
+		keys[n] = copy(line, len);
+		lens[n] = len;
+		n++;
+	}
+
+	struct xf_mph m;
+	uint32_t *disp = check(malloc(xf_mph_nbuckets(n) * sizeof(*disp)));
+	uint32_t *slots = check(malloc((n + 1) * sizeof(*slots)));
+	uint32_t *at = check(malloc((n + 1) * sizeof(*at)));
+	if (xf_mph_build(&m, disp, slots, keys, lens, n)) {
+		fprintf(stderr, "repeated keys in input\n");
+		return 1;
+	}
+	for (i = 0; i < n; i++)
+		at[slots[i]] = i;
+
+	printf("/* generated by xf-mph-gen, %u keys */\n", n);
+	printf("#include \"xf-mph.h\"\n\n");
+	printf("static const uint32_t %s_disp[%u] = {", name, m.nbuckets);
+	for (i = 0; i < m.nbuckets; i++)
+		printf("%s%u,", i % 12 ? " " : "\n\t", disp[i]);
+	printf("\n};\n\n");
+	printf("static const struct xf_mph_key %s_keys[%u] = {\n", name,
+			n ? n : 1);
+	for (i = 0; i < n; i++) {
+		printf("\t{\"");
+		print_str(keys[at[i]], lens[at[i]]);
+		printf("\", %zu},\n", lens[at[i]]);
+	}
+	if (n == 0) /* ISO C allows no empty initializers */
+		printf("\t{0}\n");
+	printf("};\n\n");
+	if (vtype) {
+		printf("static const %s %s_values[%u] = {\n", vtype, name,
+				n ? n : 1);
+		for (i = 0; i < n; i++)
+			printf("\t%s,\n", vals[at[i]]);
+		if (n == 0)
+			printf("\t0\n");
+		printf("};\n\n");
+	}
+	printf("static const struct xf_mph %s = {\n", name);
+	printf("\t0x%016llxull, %u, %u, %s_disp, %s_keys\n",
+			(unsigned long long) m.seed, n, m.nbuckets, name, name);
+	printf("};\n");
+	return 0;
+}
@@ -0,0 +1,148 @@
+#if !defined(XFSTATIC) /* is .c processed first? */
+#define _XF_STATIC 0 /* avoid looping between .c and .h */
+#define _XF_MACROS 1
+#include "xf-mph.h"
+#endif
+
+#include <stdlib.h> // malloc calloc free
+#include <string.h> // memcmp memset
+#include <assert.h> // assert
+
+XFFNC long xf_mph_find(const struct xf_mph *m, const void *key, size_t len)
+{
+	if (m->nkeys == 0)
+		return -1;
+	uint32_t s = xf_mph_slot(m, xf_hash_wy64(key, len, m->seed));
+	if (m->keys != NULL && (m->keys[s].len != len
+				|| memcmp(m->keys[s].key, key, len)))
+		return -1;
+	return s;
+}
+
+XFFNC uint32_t xf_mph_nbuckets(uint32_t n)
+{
+	return n / 3 + 1;
+}
+
+/**
+ * xf_mph_try() - try to place all keys with the current seed
+ * @m:		table with @seed, @nkeys, @nbuckets and @disp set
+ * @hash:	hash of each key
+ * @order:	keys grouped by bucket, the largest buckets first
+ * @start:	offset of each group in @order and one past the last
+ * @ngroups:	non-empty buckets
+ * @taken:	@nkeys bytes cleared, set for each slot taken
+ * @slots:	where to write the slot of each key
+ *
+ * Return:	0 if all the keys were placed, -1 if a bucket couldn't be
+ */
+static int xf_mph_try(struct xf_mph *m, const uint64_t *hash,
+		const uint32_t *order, const uint32_t *start, uint32_t ngroups,
+		uint8_t *taken, uint32_t *slots)
+{
+	uint32_t *disp = (uint32_t *) m->disp;
+	uint32_t g, i, d;
+
+	for (g = 0; g < ngroups; g++) {
+		const uint32_t *ks = order + start[g];
+		uint32_t nk = start[g + 1] - start[g];
+		uint32_t b = (uint32_t) (((hash[ks[0]] >> 32) * m->nbuckets) >> 32);
+		for (d = 0; d < XF_MPH_TRIES; d++) {
+			disp[b] = d;
+			for (i = 0; i < nk; i++) {
+				uint32_t s = xf_mph_slot(m, hash[ks[i]]);
+				if (taken[s])
+					break;
+				taken[s] = 1;
+				slots[ks[i]] = s;
+			}
+			if (i == nk)
+				break;
+			while (i--) /* undo this attempt */
+				taken[slots[ks[i]]] = 0;
+		}
+		if (d == XF_MPH_TRIES)
+			return -1;
+	}
+	return 0;
+}
+
+XFFNC int xf_mph_build(struct xf_mph *m, uint32_t *disp, uint32_t *slots,
+		const void *const *keys, const size_t *lens, uint32_t n)
+{
+	uint32_t nb = xf_mph_nbuckets(n), i, b;
+	uint64_t *hash = malloc(n * sizeof(*hash) + 1);
+	uint32_t *bucket = malloc(n * sizeof(*bucket) + 1);
+	uint32_t *count = malloc((nb + 1) * sizeof(*count));
+	uint32_t *order = malloc(n * sizeof(*order) + 1);
+	uint32_t *start = malloc((nb + 1) * sizeof(*start));
+	uint32_t *fill = malloc(nb * sizeof(*fill));
+	uint8_t *taken = malloc(n + 1);
+	uint32_t ngroups, maxlen, len, at;
+	int rv = XF_HTABLE_ESUCCESS;
+
+	assert(hash && bucket && count && order && start && fill && taken);
+	m->seed = 0;
+	m->nkeys = n;
+	m->nbuckets = nb;
+	m->disp = disp;
+	for (;;) {
+		memset(disp, 0, nb * sizeof(*disp));
+		memset(count, 0, (nb + 1) * sizeof(*count));
+		maxlen = 0;
+		for (i = 0; i < n; i++) {
+			hash[i] = xf_hash_wy64(keys[i], lens[i], m->seed);
+			bucket[i] = (uint32_t) (((hash[i] >> 32) * nb) >> 32);
+			if (++count[bucket[i]] > maxlen)
+				maxlen = count[bucket[i]];
+		}
+		/* group the keys by bucket, largest buckets first */
+		ngroups = 0;
+		at = 0;
+		for (len = maxlen; len > 0; len--) {
+			for (b = 0; b < nb; b++) {
+				if (count[b] != len)
+					continue;
+				start[ngroups++] = at;
+				fill[b] = at;
+				at += len;
+			}
+		}
+		start[ngroups] = at;
+		for (i = 0; i < n; i++)
+			order[fill[bucket[i]]++] = i;
+
+		/* repeated keys would never be placed, look for them */
+		uint32_t g, j, k;
+		int collide = 0;
+		for (g = 0; g < ngroups && !collide; g++) {
+			for (j = start[g]; j < start[g + 1]; j++) {
+				for (k = j + 1; k < start[g + 1]; k++) {
+					uint32_t x = order[j], y = order[k];
+					if (hash[x] != hash[y])
+						continue;
+					if (lens[x] == lens[y] && !memcmp(keys[x],
+								keys[y], lens[x])) {
+						rv = XF_HTABLE_ESET;
+						goto out;
+					}
+					collide = 1;
+				}
+			}
+		}
+		memset(taken, 0, n);
+		if (!collide && !xf_mph_try(m, hash, order, start, ngroups,
+					taken, slots))
+			break;
+		m->seed = xf_hash_wy64(&m->seed, sizeof(m->seed), m->seed + 1);
+	}
+out:
+	free(hash);
+	free(bucket);
+	free(count);
+	free(order);
+	free(start);
+	free(fill);
+	free(taken);
+	return rv;
+}
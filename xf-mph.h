@@ -0,0 +1,152 @@
+/**
+ * DOC: xf-mph.h
+ * Minimal perfect hashing of a fixed set of keys.
+ *
+ * DOC: README
+ * For a set of n keys known in advance, such as keywords or opcode names, a
+ * minimal perfect hash maps each of them to a distinct index in 0..n-1.
+ * Looking a key up then takes one xf_hash_wy64(), one table read and one
+ * comparison, with nothing to construct at runtime.
+ *
+ * The keys are hashed and spread over n/3 buckets by the hash. Each bucket
+ * gets a displacement, found by xf_mph_build(), that is mixed into the
+ * hashes of its keys to place them on slots no other key took.
+ *
+ * The tables are normally built ahead of time by the xf-mph-gen tool
+ * (xf-mph-gen.c), which reads keys one per line and writes out a &struct
+ * xf_mph with its displacements and keys as constant C data:
+ *
+ *	cc -o xf-mph-gen xf-mph-gen.c
+ *	./xf-mph-gen keywords int < keywords.txt > keywords.h
+ *
+ * Header version is accessible via %_XF_MPH_H where the three version
+ * numbers are comma-separated.
+ *
+ * To externally share these functions between units (as non-static), define
+ * %_XF_STATIC 0 before including the header and separately compile
+ * xf-mph.c and xf-htable.c.
+ *
+ * To specify the function declaration flags (static, extern, inline and
+ * whatnot), define %_XF_FNC_DECLR. This defaults to static if %_XF_STATIC is 0,
+ * and no declaration keywords if it is not 0.
+ */
+
+#ifndef _XF_MPH_H
+#define _XF_MPH_H 00,03,00
+
+#include "xf-htable.h"
+
+/* #define _XF_STATIC 0 to use these as external functions */
+#ifndef _XF_STATIC // Whether library should "#include" function bodies
+#define XFSTATIC 1
+#else
+#define XFSTATIC _XF_STATIC
+#endif
+
+#if __GNUC__ /* Suppress unused warnings */
+#define XFNOWRN __attribute__((unused))
+#else
+#define XFNOWRN
+#endif
+
+#ifdef _XF_FNC_DECLR /* The flags embedded in function declaration */
+#define XFFNC XFNOWRN _XF_FNC_DECLR
+#elif XFSTATIC == 1
+#define XFFNC XFNOWRN static
+#else
+#define XFFNC XFNOWRN
+#endif
+
+/* displacements xf_mph_build() tries per bucket before changing seed */
+#ifndef XF_MPH_TRIES
+#define XF_MPH_TRIES (1u << 20)
+#endif
+
+/**
+ * struct xf_mph_key - a key of a perfect hash table
+ * @key:	the bytes of the key
+ * @len:	length of @key
+ */
+struct xf_mph_key {
+	const char *key;
+	size_t len;
+};
+
+/**
+ * struct xf_mph - a minimal perfect hash table
+ * @seed:	seed of xf_hash_wy64() the displacements were found for
+ * @nkeys:	amount of keys and slots
+ * @nbuckets:	entries in @disp, see xf_mph_nbuckets()
+ * @disp:	displacement of each bucket
+ * @keys:	the key on each slot, used by xf_mph_find() to tell keys
+ *		not in the set apart, or %NULL to skip the comparison
+ */
+struct xf_mph {
+	uint64_t seed;
+	uint32_t nkeys;
+	uint32_t nbuckets;
+	const uint32_t *disp;
+	const struct xf_mph_key *keys;
+};
+
+/**
+ * xf_mph_slot() - slot of a key with given hash
+ * @m:		the table
+ * @hash:	xf_hash_wy64() of the key with @m->seed
+ *
+ * Return:	the slot, which is only the key's if the key is in the set
+ */
+static inline uint32_t xf_mph_slot(const struct xf_mph *m, uint64_t hash)
+{
+	uint32_t b = (uint32_t) (((hash >> 32) * m->nbuckets) >> 32);
+	uint64_t x = hash ^ (m->disp[b] * 0x9e3779b97f4a7c15ull);
+	x ^= x >> 29;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 32;
+	return (uint32_t) (((x & 0xffffffffu) * m->nkeys) >> 32);
+}
+
+/**
+ * xf_mph_find() - look up a key
+ * @m:		the table
+ * @key:	key to look for
+ * @len:	length of @key
+ *
+ * Return:	index of the key among 0..@m->nkeys-1, or -1 if @m->keys is set
+ *		and @key isn't in the set
+ */
+XFFNC long xf_mph_find(const struct xf_mph *m, const void *key, size_t len);
+
+/**
+ * xf_mph_nbuckets() - amount of displacements a table of @n keys has
+ * @n:		amount of keys
+ */
+XFFNC uint32_t xf_mph_nbuckets(uint32_t n);
+
+/**
+ * xf_mph_build() - find a minimal perfect hash for a set of keys
+ * @m:		where to set @seed, @nkeys, @nbuckets and @disp; @keys is
+ *		left for the caller to set up in slot order
+ * @disp:	array of xf_mph_nbuckets() of @n displacements to fill in
+ * @slots:	where to write the slot of each key
+ * @keys:	the keys
+ * @lens:	lengths of @keys
+ * @n:		amount of keys
+ *
+ * Return:	%XF_HTABLE_ESUCCESS or %XF_HTABLE_ESET if a key is repeated
+ */
+XFFNC int xf_mph_build(struct xf_mph *m, uint32_t *disp, uint32_t *slots,
+		const void *const *keys, const size_t *lens, uint32_t n);
+
+#if XFSTATIC == 1 // Include function bodies?
+#include "xf-mph.c"
+#endif
+
+#if !defined(_XF_MACROS) || _XF_MACROS == 0
+// Clear up some internal «local» definitions
+#undef XFFNC
+#undef XFNOWRN
+#undef XFSTATIC
+#endif
+
+#endif
@@ -1,102 +1,797 @@
-
 #if !defined(XFSTATIC) /* is .c processed first? */
+#ifndef _DEFAULT_SOURCE /* mmap() flags, madvise() etc. under -std=c99 */
+#define _DEFAULT_SOURCE
+#endif
 #define _XF_STATIC 0 /* avoid looping between .c and .h */
 #define _XF_MACROS 1
 #include "xf-mregion.h"
 #endif
 
 #include <stdlib.h> // malloc free size_t
+#include <stdint.h> // uintptr_t
+#include <string.h> // memcpy memset
 #include <assert.h> // assert
+#if XF_MREGION_STATS
+#include <stdio.h> // snprintf
+#endif
+#if XF_MREGION_MMAP || XF_MREGION_FILE
+#include <sys/mman.h> // mmap munmap madvise msync
+#include <unistd.h> // sysconf ftruncate close pread
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+#if XF_MREGION_FILE
+#include <fcntl.h> // open
+#include <sys/stat.h> // fstat
+#endif
+
+/* subregions at least this large are backed with huge pages if possible */
+#define XF_MREGION_HUGE ((size_t)2 << 20)
+
+/**
+ * xf_mregion_blkalloc() - allocate memory for a subregion
+ * @size:	bytes required, header included; may get rounded up
+ * @flags:	where to write %XF_MREGION_SUB_MMAP if the memory was mmap()'ed
+ *
+ * Return:	memory aligned to %XF_MREGION_SUB_ALIGN or %NULL
+ */
+static void *xf_mregion_blkalloc(size_t *size, unsigned int *flags)
+{
+	void *p;
+#if XF_MREGION_MMAP
+	if (*size >= XF_MREGION_MMAP) {
+		size_t pg = *size >= XF_MREGION_HUGE ? XF_MREGION_HUGE
+			: (size_t) sysconf(_SC_PAGESIZE);
+		*size = (*size + pg - 1) & ~(pg - 1);
+		p = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return NULL;
+#ifdef MADV_HUGEPAGE
+		if (pg == XF_MREGION_HUGE)
+			madvise(p, *size, MADV_HUGEPAGE);
+#endif
+		*flags = XF_MREGION_SUB_MMAP;
+		return p;
+	}
+#endif
+	*flags = 0;
+	/* aligned by hand, with what malloc() returned kept right before */
+	char *raw = malloc(*size + sizeof(void *) + XF_MREGION_SUB_ALIGN - 1);
+	if (raw == NULL)
+		return NULL;
+	p = (void *) (((uintptr_t) raw + sizeof(void *)
+				+ XF_MREGION_SUB_ALIGN - 1)
+			& ~(uintptr_t) (XF_MREGION_SUB_ALIGN - 1));
+	((void **) p)[-1] = raw;
+	return p;
+}
+
+/**
+ * xf_mregion_blkfree() - release memory allocated by xf_mregion_blkalloc()
+ * @p:		the memory
+ * @size:	bytes in @p, header included
+ * @flags:	flags of the subregion in @p
+ */
+static void xf_mregion_blkfree(void *p, size_t size, unsigned int flags)
+{
+	if (flags & XF_MREGION_SUB_FILE)
+		return; /* part of the file mapping */
+#if XF_MREGION_MMAP
+	if (flags & XF_MREGION_SUB_MMAP) {
+		munmap(p, size);
+		return;
+	}
+#else
+	(void) size;
+	(void) flags;
+#endif
+	free(((void **) p)[-1]);
+}
+
+#if XF_MREGION_FILE
+/* the header of the file a file backed region @r is in */
+#define XF_MREGION_FILE_OF(r) (((struct xf_mregion_file *) (r)) - 1)
+
+/**
+ * xf_mregion_file_carve() - take memory for a subregion from the file
+ * @r:		file backed region
+ * @size:	bytes required, header included; gets rounded up
+ *
+ * Return:	memory aligned to %XF_MREGION_SUB_ALIGN or %NULL if the
+ *		reservation of the file has been exhausted
+ */
+static void *xf_mregion_file_carve(struct xf_mregion *r, size_t *size)
+{
+	struct xf_mregion_file *f = XF_MREGION_FILE_OF(r);
+	size_t bytes = (*size + XF_MREGION_SUB_ALIGN - 1)
+		& ~((size_t) XF_MREGION_SUB_ALIGN - 1);
+#if __GNUC__ /* may be called from xf_mregion_alloc_atomic() */
+	/* only advance if it fits, failed attempts mustn't eat the reserve */
+	uint64_t off = __atomic_load_n(&f->length, __ATOMIC_RELAXED);
+	do {
+		if (off + bytes > f->reserve)
+			return NULL;
+	} while (!__atomic_compare_exchange_n(&f->length, &off, off + bytes,
+				1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+#else
+	uint64_t off = f->length;
+	if (off + bytes > f->reserve)
+		return NULL;
+	f->length += bytes;
+#endif
+	*size = bytes;
+	return (char *) f + off;
+}
+#endif
+
+/**
+ * xf_mregion_sub_new() - allocate an empty, unlinked subregion
+ * @r:		region the subregion is for
+ * @size:	minimum size of the @data array
+ *
+ * Return:	%NULL if @r is file backed and its reservation is exhausted
+ */
+static struct xf_mregion_sub *xf_mregion_sub_new(struct xf_mregion *r,
+		size_t size)
+{
+	unsigned int flags;
+	size_t bytes = sizeof(struct xf_mregion_sub) + size;
+	struct xf_mregion_sub *s = NULL;
+#if XF_MREGION_FILE
+	if (r->sub.flags & XF_MREGION_SUB_FILE) {
+		s = xf_mregion_file_carve(r, &bytes);
+		if (s == NULL)
+			return NULL;
+		flags = XF_MREGION_SUB_FILE;
+	}
+#else
+	(void) r;
+#endif
+	if (s == NULL) {
+		s = xf_mregion_blkalloc(&bytes, &flags);
+		assert(s != NULL);
+	}
+	s->next = NULL;
+	s->size = bytes - sizeof(struct xf_mregion_sub);
+	s->length = 0;
+	s->flags = flags;
+	return s;
+}
+
+/**
+ * xf_mregion_sub_reuse() - account for a subregion the cursor moves into
+ * @r:		region of @s
+ * @s:		the subregion that will be allocated from next
+ */
+static inline void xf_mregion_sub_reuse(struct xf_mregion *r,
+		struct xf_mregion_sub *s)
+{
+	if (s->flags & XF_MREGION_SUB_DROPPED) {
+		s->flags &= ~XF_MREGION_SUB_DROPPED;
+		r->dropped -= s->size;
+	}
+}
+
+/**
+ * xf_mregion_nextsize() - size of the next subregion to allocate
+ * @r:		region to grow
+ * @total:	@r->total
+ * @previous:	size of the last subregion of @r
+ * @need:	minimum size required
+ */
+static size_t xf_mregion_nextsize(struct xf_mregion *r, XFNOWRN size_t total,
+		size_t previous, size_t need)
+{
+	const struct xf_mregion_grow *g = &r->grow;
+	size_t nsz;
+
+	if (g->factor == 0) {
+		nsz = XF_MREGION_EXP_ALLOC(total, r->sub.size, previous);
+	} else {
+		/* previous * factor / 100 without overflowing early */
+		nsz = previous / 100 * g->factor
+			+ previous % 100 * g->factor / 100;
+		if (nsz < g->min)
+			nsz = g->min;
+		if (g->max != 0 && nsz > g->max)
+			nsz = g->max;
+	}
+	return nsz < need ? need : nsz;
+}
+
+#if XF_MREGION_STATS
+/* histogram bin of an allocation of @size bytes */
+static unsigned int xf_mregion_stat_bin(size_t size)
+{
+	unsigned int bin = 0;
+	while ((size >>= 1) != 0 && bin < XF_MREGION_STATS_HIST - 1)
+		bin++;
+	return bin;
+}
+
+/**
+ * xf_mregion_stat_alloc() - account for an allocation
+ * @r:		region allocated from
+ * @size:	bytes requested
+ * @used:	bytes taken from the subregion, padding included
+ */
+static void xf_mregion_stat_alloc(struct xf_mregion *r, size_t size,
+		size_t used)
+{
+	struct xf_mregion_stats *st = &r->stats;
+	st->allocs++;
+	st->requested += size;
+	st->inuse += used;
+	if (st->inuse > st->hiwat)
+		st->hiwat = st->inuse;
+	st->hist[xf_mregion_stat_bin(size)]++;
+}
+#define XF_MREGION_STAT(expr) expr
+#else
+#define XF_MREGION_STAT(expr)
+#endif
+
+/* bytes to skip for @p to be aligned to @align */
+#define XF_MREGION_PAD(p, align) (-(uintptr_t)(p) & ((align) - 1))
 
 XFFNC struct xf_mregion *xf_mregion_create(size_t initsize)
 {
-	struct xf_mregion_sub *r = malloc(
-			sizeof(struct xf_mregion_sub) + initsize);
+	return xf_mregion_create_grow(initsize, NULL);
+}
+
+/**
+ * xf_mregion_init() - initialize a region in memory already allocated for it
+ * @r:		the memory, sizeof(struct xf_mregion) + @size bytes
+ * @size:	size of @r->sub.data
+ * @flags:	flags of @r->sub
+ * @g:		growth policy or %NULL
+ */
+static void xf_mregion_init(struct xf_mregion *r, size_t size,
+		unsigned int flags, const struct xf_mregion_grow *g)
+{
+	r->sub.next = NULL;
+	r->sub.size = size;
+	r->sub.length = 0;
+	r->sub.flags = flags;
+	r->cur = &r->sub;
+	r->tail = &r->sub;
+	r->total = r->sub.size;
+	r->dropped = 0;
+	r->align = XF_MREGION_ALIGN;
+	r->keep = XF_MREGION_KEEP;
+#if XF_MREGION_STATS
+	memset(&r->stats, 0, sizeof(r->stats));
+	r->stats.subs = 1;
+#endif
+	if (g != NULL) {
+		r->grow = *g;
+	} else {
+		r->grow.factor = 0;
+		r->grow.min = 0;
+		r->grow.max = 0;
+	}
+}
+
+XFFNC struct xf_mregion *xf_mregion_create_grow(size_t initsize,
+		const struct xf_mregion_grow *g)
+{
+	unsigned int flags;
+	size_t bytes = sizeof(struct xf_mregion) + initsize;
+	struct xf_mregion *r = xf_mregion_blkalloc(&bytes, &flags);
 	assert(r != NULL);
-	r->next = NULL;
-	r->size = initsize;
-	r->length = 0;
+	xf_mregion_init(r, bytes - sizeof(struct xf_mregion), flags, g);
+
+	return r;
+}
+
+#if XF_MREGION_FILE
+XFFNC struct xf_mregion *xf_mregion_create_file(const char *path,
+		size_t reserve, size_t initsize, const struct xf_mregion_grow *g)
+{
+	assert(path != NULL);
+	size_t pg = (size_t) sysconf(_SC_PAGESIZE);
+	size_t head = sizeof(struct xf_mregion_file) + sizeof(struct xf_mregion)
+		+ initsize;
+	head = (head + XF_MREGION_SUB_ALIGN - 1)
+		& ~((size_t) XF_MREGION_SUB_ALIGN - 1);
+	reserve = (reserve + pg - 1) & ~(pg - 1);
+	if (reserve < head)
+		return NULL;
+
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return NULL;
+	/* sparse until written, cut down to size by xf_mregion_destroy() */
+	if (ftruncate(fd, reserve)) {
+		close(fd);
+		return NULL;
+	}
+	struct xf_mregion_file *f = mmap(NULL, reserve, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	if (f == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	memcpy(f->magic, XF_MREGION_FILE_MAGIC, sizeof(f->magic));
+	f->version = XF_MREGION_FILE_VERSION;
+	f->fd = fd;
+	f->length = head;
+	f->reserve = reserve;
+	f->root = 0;
+
+	struct xf_mregion *r = (struct xf_mregion *) (f + 1);
+	xf_mregion_init(r, head - sizeof(*f) - sizeof(*r),
+			XF_MREGION_SUB_FILE, g);
+	return r;
+}
+
+XFFNC void xf_mregion_file_setroot(struct xf_mregion *r, const void *root)
+{
+	assert(r != NULL && (r->sub.flags & XF_MREGION_SUB_FILE));
+	struct xf_mregion_file *f = XF_MREGION_FILE_OF(r);
+	assert(root == NULL || ((const char *) root > (char *) f
+				&& (const char *) root < (char *) f + f->length));
+	f->root = root == NULL ? 0 : (const char *) root - (char *) f;
+}
+
+XFFNC int xf_mregion_file_sync(struct xf_mregion *r)
+{
+	assert(r != NULL && (r->sub.flags & XF_MREGION_SUB_FILE));
+	struct xf_mregion_file *f = XF_MREGION_FILE_OF(r);
+	size_t length = f->length < f->reserve ? f->length : f->reserve;
+	return msync(f, length, MS_SYNC);
+}
+
+/**
+ * xf_mregion_file_close() - xf_mregion_destroy() for file backed regions
+ * @r:		region to unmap
+ */
+static void xf_mregion_file_close(struct xf_mregion *r)
+{
+	struct xf_mregion_file *f = XF_MREGION_FILE_OF(r);
+	size_t length = f->length < f->reserve ? f->length : f->reserve;
+	size_t reserve = f->reserve;
+	int fd = f->fd;
+
+	f->length = length;
+	msync(f, length, MS_SYNC);
+	munmap(f, reserve);
+	if (ftruncate(fd, length) != 0) {
+		/* still a valid region file, only larger than it has to be */
+	}
+	close(fd);
+}
+
+XFFNC const void *xf_mregion_file_map(const char *path)
+{
+	assert(path != NULL);
+	struct xf_mregion_file hdr;
+	struct stat st;
+	const void *map = NULL;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	/* a truncated file would map fine and SIGBUS on access */
+	if (pread(fd, &hdr, sizeof(hdr), 0) == (ssize_t) sizeof(hdr)
+			&& !memcmp(hdr.magic, XF_MREGION_FILE_MAGIC,
+				sizeof(hdr.magic))
+			&& hdr.version == XF_MREGION_FILE_VERSION
+			&& hdr.length >= sizeof(hdr)
+			&& (hdr.root == 0 || (hdr.root >= sizeof(hdr)
+					&& hdr.root < hdr.length))
+			&& !fstat(fd, &st)
+			&& (uint64_t) st.st_size >= hdr.length) {
+		map = mmap(NULL, hdr.length, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED)
+			map = NULL;
+	}
+	close(fd);
+	return map;
+}
+
+XFFNC const void *xf_mregion_file_root(const void *map)
+{
+	const struct xf_mregion_file *f = map;
+	return f->root == 0 ? NULL : (const char *) map + f->root;
+}
 
-	return (struct xf_mregion *) r;
+XFFNC void xf_mregion_file_unmap(const void *map)
+{
+	const struct xf_mregion_file *f = map;
+	munmap((void *) map, f->length);
 }
+#endif
 
 XFFNC void xf_mregion_destroy(struct xf_mregion *r)
 {
-	struct xf_mregion_sub *nxt = &r->sub;
+	struct xf_mregion_sub *nxt = r->sub.next;
 	struct xf_mregion_sub *s;
 
+#if XF_MREGION_FILE
+	if (r->sub.flags & XF_MREGION_SUB_FILE) {
+		xf_mregion_file_close(r);
+		return;
+	}
+#endif
 	while (nxt != NULL) {
 		s = nxt;
 		nxt = s->next;
 
-		free(s);
+		xf_mregion_blkfree(s, sizeof(struct xf_mregion_sub) + s->size,
+				s->flags);
 	}
+	xf_mregion_blkfree(r, sizeof(struct xf_mregion) + r->sub.size,
+			r->sub.flags);
 }
 
-XFFNC void *xf_mregion_alloc(struct xf_mregion *r, size_t size)
+XFFNC void *xf_mregion_alloc_aligned(struct xf_mregion *r, size_t size,
+		size_t align)
 {
 	assert(r != NULL);
 	assert(size > 0);
-	struct xf_mregion_sub *s;
-	for (s = &r->sub; s != NULL; s = s->next) {
-		if (s->size - s->length < size)
+	assert(align > 0 && (align & (align - 1)) == 0);
+	struct xf_mregion_sub *s = r->cur;
+	size_t pad = XF_MREGION_PAD(s->data + s->length, align);
+	if (s->size - s->length >= size + pad) {
+		void *rv = s->data + s->length + pad;
+		s->length += pad + size;
+		XF_MREGION_STAT(xf_mregion_stat_alloc(r, size, pad + size));
+		return rv;
+	}
+#if XF_MREGION_SLACK_REVISIT
+	for (s = &r->sub; s != r->cur; s = s->next) {
+		/* xf_mregion_alloc_atomic() may have overshot the size */
+		if (s->length >= s->size)
+			continue;
+		pad = XF_MREGION_PAD(s->data + s->length, align);
+		if (s->size - s->length < size + pad)
 			continue;
-		void *rv = s->data + s->length;
-		s->length += size;
+		void *rv = s->data + s->length + pad;
+		s->length += pad + size;
+		XF_MREGION_STAT(xf_mregion_stat_alloc(r, size, pad + size));
 		return rv;
 	}
-	/* Needs more memory */
-	unsigned int total = 0;
-	for (s = &r->sub; 0 == 0; s = s->next) {
-		total += s->size;
-		if (s->next == NULL) break;
+#endif
+	/* Subregions after the cursor are unused, move on if it'll fit */
+	s = r->cur->next;
+	if (s != NULL) {
+		pad = XF_MREGION_PAD(s->data, align);
+		if (s->size >= size + pad) {
+			xf_mregion_sub_reuse(r, s);
+			XF_MREGION_STAT(r->stats.wasted +=
+					r->cur->size - r->cur->length);
+			r->cur = s;
+			s->length = pad + size;
+			XF_MREGION_STAT(xf_mregion_stat_alloc(r, size,
+						pad + size));
+			return s->data + pad;
+		}
 	}
-	unsigned int nsz = XF_MREGION_EXP_ALLOC(total, r->sub.size, s->size);
-	if (nsz < size)
-		nsz = size;
+	/* Needs more memory */
+	size_t need = size;
+	if (align > XF_MREGION_SUB_ALIGN)
+		need += align - XF_MREGION_SUB_ALIGN;
+	s = xf_mregion_sub_new(r, xf_mregion_nextsize(r, r->total,
+				r->tail->size, need));
+	if (s == NULL)
+		return NULL;
+	pad = XF_MREGION_PAD(s->data, align);
+	s->next = r->cur->next;
+	s->length = pad + size;
 
-	s->next = malloc(sizeof(struct xf_mregion_sub) + nsz);
-	assert(s->next != NULL);
-	s = s->next;
+	/* link right after the cursor, keeping unused subregions for later */
+	r->cur->next = s;
+	if (r->tail == r->cur)
+		r->tail = s;
+	XF_MREGION_STAT(r->stats.wasted += r->cur->size - r->cur->length);
+	r->cur = s;
+	r->total += s->size;
+	XF_MREGION_STAT(r->stats.subs++);
+	XF_MREGION_STAT(xf_mregion_stat_alloc(r, size, pad + size));
 
-	s->next = NULL;
-	s->size = nsz;
-	s->length = size;
+	return s->data + pad;
+}
 
-	return s->data;
+XFFNC void *xf_mregion_alloc(struct xf_mregion *r, size_t size)
+{
+	return xf_mregion_alloc_aligned(r, size, r->align);
 }
 
 XFFNC void xf_mregion_clear(struct xf_mregion *r)
 {
 	struct xf_mregion_sub *s;
 
-	for (s = &r->sub; s != NULL; s = s->next)
+	for (s = &r->sub; s != r->cur; s = s->next)
 		s->length = 0;
+	s->length = 0;
+	r->cur = &r->sub;
+	XF_MREGION_STAT(r->stats.inuse = 0);
+	if (r->keep != XF_MREGION_KEEP_ALL)
+		xf_mregion_trim(r, r->keep);
 }
 
-XFFNC void xf_mregion_undo(struct xf_mregion *r, void *mem)
+XFFNC void xf_mregion_trim(struct xf_mregion *r, size_t keep)
+{
+	assert(r != NULL);
+	struct xf_mregion_sub *s, *last, **link;
+	size_t kept = 0;
+
+	/* everything up to the cursor is in use */
+	for (s = &r->sub; s != r->cur; s = s->next)
+		kept += s->size;
+	kept += s->size;
+	last = s;
+
+	for (link = &last->next; (s = *link) != NULL; ) {
+		if (s->flags & (XF_MREGION_SUB_DROPPED | XF_MREGION_SUB_FILE)) {
+			last = s;
+			link = &s->next;
+			continue;
+		}
+		if (kept + s->size <= keep) {
+			kept += s->size;
+			last = s;
+			link = &s->next;
+			continue;
+		}
+#if XF_MREGION_MMAP && defined(MADV_DONTNEED)
+		if (s->flags & XF_MREGION_SUB_MMAP) {
+			/* keep the mapping reserved, but let go of the pages */
+			size_t pg = (size_t) sysconf(_SC_PAGESIZE);
+			char *from = (char *) s + ((sizeof(*s) + pg - 1) & ~(pg - 1));
+			char *to = s->data + s->size;
+			if (from < to)
+				madvise(from, to - from, MADV_DONTNEED);
+			s->flags |= XF_MREGION_SUB_DROPPED;
+			r->dropped += s->size;
+			last = s;
+			link = &s->next;
+			continue;
+		}
+#endif
+		*link = s->next;
+		r->total -= s->size;
+		XF_MREGION_STAT(r->stats.subs--);
+		xf_mregion_blkfree(s, sizeof(struct xf_mregion_sub) + s->size,
+				s->flags);
+	}
+	r->tail = last;
+}
+
+#if __GNUC__
+/**
+ * xf_mregion_tail_catchup() - move @r->tail forward to the actual last link
+ * @r:		region that may have been appended to concurrently
+ *
+ * Only ever advances the tail along the linked-list, so threads racing here
+ * can't move it back to a subregion that has since been linked after.
+ */
+static void xf_mregion_tail_catchup(struct xf_mregion *r)
+{
+	struct xf_mregion_sub *t = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	struct xf_mregion_sub *n;
+
+	while ((n = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE)) != NULL) {
+		if (__atomic_compare_exchange_n(&r->tail, &t, n, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			t = n;
+	}
+}
+
+/**
+ * xf_mregion_atomic_full() - undo the overshoot of a full subregion
+ * @s:		subregion xf_mregion_alloc_atomic() bumped past its size
+ *
+ * Called before giving up with @s left as the cursor, so that once the
+ * threads have synchronised, xf_mregion_alloc() and xf_mregion_mark() see a
+ * full subregion rather than a length past its end.
+ */
+static void xf_mregion_atomic_full(struct xf_mregion_sub *s)
+{
+	size_t length = __atomic_load_n(&s->length, __ATOMIC_RELAXED);
+
+	while (length > s->size && !__atomic_compare_exchange_n(&s->length,
+				&length, s->size, 1, __ATOMIC_RELAXED,
+				__ATOMIC_RELAXED))
+		;
+}
+
+XFFNC void *xf_mregion_alloc_atomic(struct xf_mregion *r, size_t size)
+{
+	assert(r != NULL);
+	assert(size > 0);
+	size_t align = r->align;
+	size_t need = (size + align - 1) & ~(align - 1);
+	struct xf_mregion_sub *s, *n;
+
+	for (;;) {
+		s = __atomic_load_n(&r->cur, __ATOMIC_ACQUIRE);
+		size_t off = __atomic_fetch_add(&s->length, need,
+				__ATOMIC_RELAXED);
+		if (off + need <= s->size
+				&& !XF_MREGION_PAD(s->data + off, align)) {
+#if XF_MREGION_STATS
+			struct xf_mregion_stats *st = &r->stats;
+			__atomic_fetch_add(&st->allocs, 1, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&st->requested, size,
+					__ATOMIC_RELAXED);
+			__atomic_fetch_add(&st->inuse, need, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&st->hist[xf_mregion_stat_bin(size)],
+					1, __ATOMIC_RELAXED);
+#endif
+			return s->data + off;
+		}
+
+		/* Exhausted, see to that a large enough subregion follows */
+		n = __atomic_load_n(&s->next, __ATOMIC_ACQUIRE);
+		if (n == NULL || n->size < need) {
+			size_t total = __atomic_load_n(&r->total,
+					__ATOMIC_RELAXED);
+			struct xf_mregion_sub *tail = __atomic_load_n(&r->tail,
+					__ATOMIC_ACQUIRE);
+			struct xf_mregion_sub *ns = xf_mregion_sub_new(r,
+					xf_mregion_nextsize(r, total,
+						tail->size, need));
+			if (ns == NULL) {
+				xf_mregion_atomic_full(s);
+				return NULL;
+			}
+			ns->next = n;
+			if (__atomic_compare_exchange_n(&s->next, &n, ns, 0,
+						__ATOMIC_ACQ_REL,
+						__ATOMIC_ACQUIRE)) {
+				__atomic_fetch_add(&r->total, ns->size,
+						__ATOMIC_RELAXED);
+				XF_MREGION_STAT(__atomic_fetch_add(
+						&r->stats.subs, 1,
+						__ATOMIC_RELAXED));
+				xf_mregion_tail_catchup(r);
+				n = ns;
+			} else {
+				/* lost the race, @n is what the winner linked */
+				xf_mregion_blkfree(ns, sizeof(*ns) + ns->size,
+						ns->flags);
+			}
+		}
+		/* Fails harmlessly if another thread moved the cursor first */
+		if (__atomic_compare_exchange_n(&r->cur, &s, n, 0,
+					__ATOMIC_ACQ_REL, __ATOMIC_RELAXED)
+				&& (n->flags & XF_MREGION_SUB_DROPPED)) {
+			n->flags &= ~XF_MREGION_SUB_DROPPED;
+			__atomic_fetch_sub(&r->dropped, n->size,
+					__ATOMIC_RELAXED);
+		}
+	}
+}
+#endif
+
+XFFNC struct xf_mregion_mark xf_mregion_mark(struct xf_mregion *r)
 {
-	struct xf_mregion_sub *s = &r->sub;
+	assert(r != NULL);
+	struct xf_mregion_mark m = { r->cur, r->cur->length };
+	return m;
+}
 
-	for (s = &r->sub; s != NULL; s = s->next) {
+XFFNC void xf_mregion_rewind(struct xf_mregion *r, struct xf_mregion_mark m)
+{
+	assert(r != NULL && m.sub != NULL);
+	struct xf_mregion_sub *s;
+
+	for (s = m.sub; s != r->cur; s = s->next) {
+		assert(s->next != NULL); /* mark not before the cursor */
+		XF_MREGION_STAT(r->stats.inuse -= s->next->length);
+		s->next->length = 0;
+	}
+	assert(m.length <= m.sub->length);
+	XF_MREGION_STAT(r->stats.inuse -= m.sub->length - m.length);
+	m.sub->length = m.length;
+	r->cur = m.sub;
+}
+
+/**
+ * xf_mregion_sub_of() - find the subregion holding an active allocation
+ * @r:		region to look in
+ * @mem:	memory allocated from @r
+ *
+ * Return:	the subregion, %NULL if @mem is not part of active region
+ */
+static struct xf_mregion_sub *xf_mregion_sub_of(struct xf_mregion *r,
+		void *mem)
+{
+	struct xf_mregion_sub *s = r->cur;
+
+	if (((char *)mem) >= s->data && ((char *)mem) <= s->data + s->length)
+		return s;
+	for (s = &r->sub; s != r->cur; s = s->next) {
 		if (((char *)mem) < s->data || ((char *)mem) > s->data + s->length)
 			continue;
-		s->length = (unsigned int) ((char *)mem - s->data);
+		return s;
+	}
+	return NULL;
+}
+
+XFFNC void xf_mregion_undo(struct xf_mregion *r, void *mem)
+{
+	struct xf_mregion_sub *s = xf_mregion_sub_of(r, mem);
+
+	/* if s is NULL, mem is not part of (active) region */
+	assert(s != NULL);
+	if (s == NULL)
 		return;
+	XF_MREGION_STAT(r->stats.inuse -= s->data + s->length - (char *)mem);
+	s->length = (size_t) ((char *)mem - s->data);
+}
+
+XFFNC void *xf_mregion_realloc_last(struct xf_mregion *r, void *mem,
+		size_t size)
+{
+	assert(r != NULL);
+	assert(size > 0);
+	if (mem == NULL)
+		return xf_mregion_alloc(r, size);
+
+	struct xf_mregion_sub *s = xf_mregion_sub_of(r, mem);
+	assert(s != NULL);
+	size_t off = (size_t) ((char *)mem - s->data);
+	size_t old = s->length - off;
+
+	if (s->size - off >= size) {
+#if XF_MREGION_STATS
+		r->stats.inuse = r->stats.inuse - old + size;
+		if (r->stats.inuse > r->stats.hiwat)
+			r->stats.hiwat = r->stats.inuse;
+#endif
+		s->length = off + size;
+		return mem;
+	}
+	/* Doesn't fit, give the space back and move it elsewhere */
+	XF_MREGION_STAT(r->stats.inuse -= old);
+	s->length = off;
+	void *rv = xf_mregion_alloc(r, size);
+	if (rv == NULL) {
+		XF_MREGION_STAT(r->stats.inuse += old);
+		s->length = off + old;
+		return NULL;
 	}
-	/* if control reaches this point, mem is not part of (active) region */
-	assert(1==2);
-	return;
+	/* the old copy is intact, nothing can be allocated over it here */
+	memcpy(rv, mem, old < size ? old : size);
+	return rv;
 }
 
 XFFNC size_t xf_mregion_memcnt(struct xf_mregion *r)
 {
 	assert(r != NULL);
-	struct xf_mregion_sub *s;
-	size_t cnt = 0;
-	for (s = &r->sub; s != NULL; s = s->next)
-		cnt += s->size;
+	return r->total;
+}
 
-	return cnt;
+XFFNC size_t xf_mregion_rescnt(struct xf_mregion *r)
+{
+	assert(r != NULL);
+	return r->total - r->dropped;
 }
 
+#if XF_MREGION_STATS
+XFFNC int xf_mregion_stats_dump(struct xf_mregion *r, char *buf, size_t n)
+{
+	assert(r != NULL);
+	const struct xf_mregion_stats *st = &r->stats;
+	int i, len, rv;
+
+	rv = snprintf(buf, n, "allocs=%zu requested=%zu inuse=%zu hiwat=%zu "
+			"reserved=%zu resident=%zu wasted=%zu subregions=%zu "
+			"hist=",
+			st->allocs, st->requested, st->inuse, st->hiwat,
+			xf_mregion_memcnt(r), xf_mregion_rescnt(r), st->wasted,
+			st->subs);
+	for (i = 0; i < XF_MREGION_STATS_HIST && rv >= 0; i++) {
+		len = snprintf((size_t) rv < n ? buf + rv : NULL,
+				(size_t) rv < n ? n - rv : 0,
+				i ? ",%zu" : "%zu", st->hist[i]);
+		rv = len < 0 ? len : rv + len;
+	}
+	return rv;
+}
+#endif
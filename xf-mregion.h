@@ -23,7 +23,10 @@
  */
 
 #ifndef _XF_MREGION_H
-#define _XF_MREGION_H 00,02,11
+#define _XF_MREGION_H 00,03,00
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uintN_t intptr_t
 
 /* #define _XF_STATIC 0 to use these as external functions */
 #ifndef _XF_STATIC // Whether library should "#include" function bodies
@@ -46,6 +49,96 @@
 #define XFFNC XFNOWRN
 #endif
 
+#if __GNUC__ /* Alignment of structure members */
+#define XFALIGN(n) __attribute__((aligned(n)))
+#else
+#define XFALIGN(n)
+#endif
+
+#ifndef XF_MREGION_SUB_ALIGN
+/**
+ * XF_MREGION_SUB_ALIGN - alignment of the beginning of subregion data
+ *
+ * Every &struct xf_mregion_sub is allocated so that its @data begins at a
+ * multiple of this many bytes. Defaults to 64, the common cache-line size,
+ * so that objects placed in different cache-lines of a region don't share
+ * one by accident.
+ */
+#define XF_MREGION_SUB_ALIGN 64
+#endif
+
+#ifndef XF_MREGION_ALIGN
+/**
+ * XF_MREGION_ALIGN - default alignment of xf_mregion_alloc()
+ *
+ * The initial value of &struct xf_mregion.align for new regions. Unless
+ * defined before the xf-mregion.h is included, the definition is 1 (no
+ * padding between allocations).
+ */
+#define XF_MREGION_ALIGN 1
+#endif
+
+#ifndef XF_MREGION_MMAP
+/**
+ * XF_MREGION_MMAP - size from which subregions are mmap()'ed
+ *
+ * Subregions taking up at least this many bytes are mapped with mmap()
+ * instead of being allocated from the heap, the ones of at least 2 MiB are
+ * also advised to be backed by transparent huge pages. Their size is
+ * rounded up to a whole page (or huge page), the extra goes to @data.
+ *
+ * Defaults to 0, which disables mmap() altogether. Only to be enabled on
+ * systems that provide <sys/mman.h>. Compiled on its own, xf-mregion.c
+ * defines _DEFAULT_SOURCE for %MAP_ANONYMOUS and madvise(); when the
+ * function bodies are included instead, the including unit has to define
+ * _DEFAULT_SOURCE before its first system header, as a strict -std or a
+ * _POSIX_C_SOURCE of its own hides them. Without %MADV_DONTNEED,
+ * xf_mregion_trim() unmaps the subregions it would have released instead.
+ */
+#define XF_MREGION_MMAP 0
+#endif
+
+#ifndef XF_MREGION_STATS
+/**
+ * XF_MREGION_STATS - whether to keep allocation statistics
+ *
+ * Define as 1 before including the header (and, if shared, when compiling
+ * xf-mregion.c) to have every region keep a &struct xf_mregion_stats in
+ * @stats. As this changes the layout of &struct xf_mregion, all of the
+ * units sharing regions have to agree on it. Defaults to 0, in which case
+ * neither the member nor any of the bookkeeping is compiled in.
+ */
+#define XF_MREGION_STATS 0
+#endif
+
+/* bins in &struct xf_mregion_stats.hist */
+#define XF_MREGION_STATS_HIST 16
+
+#ifndef XF_MREGION_FILE
+/**
+ * XF_MREGION_FILE - whether to provide file backed regions
+ *
+ * Define as 1 before including the header to get xf_mregion_create_file()
+ * and the related functions. Requires <sys/mman.h> and <fcntl.h>, thus
+ * defaults to 0. See %XF_MREGION_MMAP about _DEFAULT_SOURCE.
+ */
+#define XF_MREGION_FILE 0
+#endif
+
+/* value of &struct xf_mregion.keep to never trim on xf_mregion_clear() */
+#define XF_MREGION_KEEP_ALL ((size_t) -1)
+
+#ifndef XF_MREGION_KEEP
+/**
+ * XF_MREGION_KEEP - default amount of memory kept by xf_mregion_clear()
+ *
+ * The initial value of &struct xf_mregion.keep for new regions, unless
+ * defined before the xf-mregion.h is included this is
+ * %XF_MREGION_KEEP_ALL.
+ */
+#define XF_MREGION_KEEP XF_MREGION_KEEP_ALL
+#endif
+
 #ifndef XF_MREGION_EXP_ALLOC
 /**
  * XF_MREGION_EXP_ALLOC() - function used to get the size of a new subregion
@@ -59,38 +152,205 @@
  * If the value yielded by this macro is less than what was required,
  * then the required value will be used instead.
  *
- * Return:	The returned unsigned integer value will be used to
+ * This is only used by regions that were not given a &struct xf_mregion_grow
+ * policy at creation.
+ *
+ * Return:	The returned size_t value will be used to
  * 		determine how much data the next subregion will be able to
  * 		hold.
  */
 #define XF_MREGION_EXP_ALLOC(total,initsize,previous) initsize
 #endif
 
+#ifndef XF_MREGION_SLACK_REVISIT
+/**
+ * XF_MREGION_SLACK_REVISIT - whether to reuse tail slack of earlier blocks
+ *
+ * By default xf_mregion_alloc() only bumps the cursor of the current
+ * subregion: when an allocation does not fit, the unused tail of the current
+ * subregion is left alone until xf_mregion_clear() and allocation moves on
+ * to the next subregion. This keeps xf_mregion_alloc() constant time no
+ * matter how many subregions the region has.
+ *
+ * Define this as 1 before including the header to have xf_mregion_alloc()
+ * first-fit search the subregions before the current one when the current
+ * one is exhausted. This trades allocation speed for tighter packing.
+ */
+#define XF_MREGION_SLACK_REVISIT 0
+#endif
+
+/**
+ * enum - &struct xf_mregion_sub flags
+ * @XF_MREGION_SUB_MMAP:	the subregion was mmap()'ed
+ * @XF_MREGION_SUB_DROPPED:	the pages of @data were given back to the
+ *				system by xf_mregion_trim()
+ * @XF_MREGION_SUB_FILE:	the subregion is part of a file mapping, see
+ *				xf_mregion_create_file()
+ */
+enum {
+	XF_MREGION_SUB_MMAP =		1 << 0,
+	XF_MREGION_SUB_DROPPED =	1 << 1,
+	XF_MREGION_SUB_FILE =		1 << 2,
+};
+
 /**
  * struct xf_mregion_sub - information associated with a subregion
  * @next:	the link to the next subregion or %NULL if this is the last
  * @size:	size of the @data array
  * @length:	length to which the @data array is used
- * @data:	memory for xf_mregion_alloc()
+ * @flags:	%XF_MREGION_SUB_* flags
+ * @data:	memory for xf_mregion_alloc(), aligned to %XF_MREGION_SUB_ALIGN
  */
 struct xf_mregion_sub {
 	struct xf_mregion_sub *next;
-	unsigned int size;
-	unsigned int length;
-	char data[];
+	size_t size;
+	size_t length;
+	unsigned int flags;
+	char data[] XFALIGN(XF_MREGION_SUB_ALIGN);
+};
+
+/**
+ * struct xf_mregion_stats - allocation statistics of a region
+ * @allocs:	allocations served
+ * @requested:	bytes asked for by those allocations
+ * @inuse:	bytes currently allocated, alignment padding included
+ * @hiwat:	the highest @inuse has been
+ * @wasted:	bytes left unused at the end of subregions when allocation
+ *		moved on to another subregion, counted as it moves on even
+ *		if %XF_MREGION_SLACK_REVISIT later fills some of them
+ * @subs:	subregions in the region
+ * @hist:	allocations by size, @hist[i] counts sizes from 2^i up to
+ *		2^(i+1) - 1 and the last bin everything larger
+ *
+ * All but @inuse and @subs are cumulative over the lifetime of the region.
+ * xf_mregion_alloc_atomic() does not keep @hiwat or @wasted up to date.
+ */
+struct xf_mregion_stats {
+	size_t allocs;
+	size_t requested;
+	size_t inuse;
+	size_t hiwat;
+	size_t wasted;
+	size_t subs;
+	size_t hist[XF_MREGION_STATS_HIST];
+};
+
+/**
+ * struct xf_mregion_grow - growth policy of a region
+ * @factor:	size of a new subregion relative to the previous one in
+ *		percent: 100 keeps the size constant, 200 doubles it; 0 to
+ *		use %XF_MREGION_EXP_ALLOC() instead of this policy
+ * @min:	lower bound for the size of a new subregion
+ * @max:	upper bound for the size of a new subregion, 0 for none
+ *
+ * A single allocation larger than @max still gets a subregion of its own.
+ * Geometric growth keeps the number of subregions logarithmic in the
+ * amount of memory the region holds.
+ */
+struct xf_mregion_grow {
+	unsigned int factor;
+	size_t min;
+	size_t max;
 };
 
 /**
  * struct xf_mregion - first link in memory region
+ * @cur:	the subregion allocations are currently bumped from; every
+ *		subregion after it is unused
+ * @tail:	the last subregion in the linked-list
+ * @total:	sum of @size over all of the subregions
+ * @dropped:	sum of @size over the %XF_MREGION_SUB_DROPPED subregions
+ * @align:	alignment used by xf_mregion_alloc(), a power of two; free to
+ *		be changed at any time, initially %XF_MREGION_ALIGN
+ * @keep:	bytes of subregions xf_mregion_clear() keeps, the rest is
+ *		given to xf_mregion_trim(); initially %XF_MREGION_KEEP
+ * @grow:	growth policy given to xf_mregion_create_grow()
+ * @stats:	allocation statistics, only if %XF_MREGION_STATS
  * @sub:	&struct xf_mregion_sub accessor
  *
  * This is separate from &struct xf_mregion_sub to make a distinction on the
  * beginning of the linked-list.
  */
 struct xf_mregion {
+	struct xf_mregion_sub *cur;
+	struct xf_mregion_sub *tail;
+	size_t total;
+	size_t dropped;
+	size_t align;
+	size_t keep;
+	struct xf_mregion_grow grow;
+#if XF_MREGION_STATS
+	struct xf_mregion_stats stats;
+#endif
 	struct xf_mregion_sub sub;
 };
 
+/**
+ * struct xf_mregion_mark - a position in a region to rewind back to
+ * @sub:	the subregion that was being allocated from
+ * @length:	@sub->length at the time the mark was taken
+ *
+ * Returned by xf_mregion_mark(), treat as opaque.
+ */
+struct xf_mregion_mark {
+	struct xf_mregion_sub *sub;
+	size_t length;
+};
+
+#if XF_MREGION_FILE
+#define XF_MREGION_FILE_MAGIC "xfmregn"
+#define XF_MREGION_FILE_VERSION 1
+
+/**
+ * struct xf_mregion_file - header at the beginning of a region file
+ * @magic:	%XF_MREGION_FILE_MAGIC, '\0' terminated
+ * @version:	%XF_MREGION_FILE_VERSION
+ * @fd:		file descriptor while the file is being built, meaningless
+ *		once written
+ * @length:	bytes of the file in use
+ * @reserve:	bytes of address space reserved for the region to grow into
+ *		while it is being built
+ * @root:	offset of the root object from the beginning of the file, 0
+ *		if none was set
+ *
+ * The file backed &struct xf_mregion and its subregions follow right after
+ * this header.
+ */
+struct xf_mregion_file {
+	char magic[8];
+	uint32_t version;
+	int32_t fd;
+	uint64_t length;
+	uint64_t reserve;
+	uint64_t root;
+} XFALIGN(XF_MREGION_SUB_ALIGN);
+#endif
+
+/**
+ * xf_mregion_relptr_set() - store a self-relative pointer
+ * @slot:	where to store the pointer
+ * @p:		what to point to, may be %NULL
+ *
+ * Pointers stored this way stay valid when the memory holding both @slot
+ * and @p is mapped to another address, which is what a region built with
+ * xf_mregion_create_file() and read with xf_mregion_file_map() requires.
+ */
+static inline void xf_mregion_relptr_set(int64_t *slot, const void *p)
+{
+	*slot = p == NULL ? 0 : (intptr_t) p - (intptr_t) slot;
+}
+
+/**
+ * xf_mregion_relptr_get() - load a pointer stored by xf_mregion_relptr_set()
+ * @slot:	where the pointer was stored
+ *
+ * Return:	the pointer or %NULL
+ */
+static inline void *xf_mregion_relptr_get(const int64_t *slot)
+{
+	return *slot == 0 ? NULL : (void *) ((intptr_t) slot + *slot);
+}
+
 /**
  * xf_mregion_create() - initializes an instance of region-based memory manager
  * @initsize:	bytes of data the initial memory subregion should be able
@@ -101,6 +361,87 @@ struct xf_mregion {
  */
 XFFNC struct xf_mregion *xf_mregion_create(size_t initsize);
 
+/**
+ * xf_mregion_create_grow() - initializes a region with a growth policy
+ * @initsize:	bytes of data the initial memory subregion should be able
+ * 		to hold
+ * @g:		how further subregions are sized, copied into the region;
+ *		%NULL for %XF_MREGION_EXP_ALLOC()
+ *
+ * Example, for a region that starts at 4 KiB and doubles up to 64 MiB
+ * subregions:
+ *
+ *	struct xf_mregion_grow g = { 200, 4096, 64 << 20 };
+ *	struct xf_mregion *r = xf_mregion_create_grow(4096, &g);
+ */
+XFFNC struct xf_mregion *xf_mregion_create_grow(size_t initsize,
+		const struct xf_mregion_grow *g);
+
+#if XF_MREGION_FILE
+/**
+ * xf_mregion_create_file() - initializes a region that lives in a file
+ * @path:	file to create, truncated if it exists
+ * @reserve:	the most bytes the file may grow to, this much address space
+ *		is reserved up front
+ * @initsize:	bytes of data the initial memory subregion should be able
+ *		to hold
+ * @g:		growth policy or %NULL, see xf_mregion_create_grow()
+ *
+ * All of the subregions are carved out of a shared mapping of @path, so
+ * after xf_mregion_file_setroot() and xf_mregion_destroy() (or
+ * xf_mregion_file_sync()) another process can xf_mregion_file_map() the
+ * file and use the data right away. Pointers between objects in the region
+ * have to be stored with xf_mregion_relptr_set() for that to work.
+ *
+ * Once @reserve is used up, xf_mregion_alloc() returns %NULL. Trimming
+ * leaves the subregions of such a region alone.
+ *
+ * Return:	%NULL if the file couldn't be created or mapped
+ */
+XFFNC struct xf_mregion *xf_mregion_create_file(const char *path,
+		size_t reserve, size_t initsize,
+		const struct xf_mregion_grow *g);
+
+/**
+ * xf_mregion_file_setroot() - set the object xf_mregion_file_root() returns
+ * @r:		region created with xf_mregion_create_file()
+ * @root:	memory allocated from @r or %NULL
+ */
+XFFNC void xf_mregion_file_setroot(struct xf_mregion *r, const void *root);
+
+/**
+ * xf_mregion_file_sync() - write the region to its file
+ * @r:		region created with xf_mregion_create_file()
+ *
+ * Return:	0 on success, like msync()
+ */
+XFFNC int xf_mregion_file_sync(struct xf_mregion *r);
+
+/**
+ * xf_mregion_file_map() - map a region file read-only
+ * @path:	file written by a region from xf_mregion_create_file()
+ *
+ * Return:	the mapping to be given to xf_mregion_file_root() and
+ *		xf_mregion_file_unmap(), %NULL if @path couldn't be mapped or
+ *		isn't a complete region file with its root inside of it
+ */
+XFFNC const void *xf_mregion_file_map(const char *path);
+
+/**
+ * xf_mregion_file_root() - get the root object of a mapped region file
+ * @map:	as returned by xf_mregion_file_map()
+ *
+ * Return:	the root object or %NULL if none was set
+ */
+XFFNC const void *xf_mregion_file_root(const void *map);
+
+/**
+ * xf_mregion_file_unmap() - release a mapping of xf_mregion_file_map()
+ * @map:	mapping no longer required
+ */
+XFFNC void xf_mregion_file_unmap(const void *map);
+#endif
+
 /**
  * xf_mregion_destroy() - releases all memory associated with a memory region
  * @r:		memory region to release
@@ -116,9 +457,52 @@ XFFNC void xf_mregion_destroy(struct xf_mregion *r);
  * shift location. (Guaranteed pointer relevance until xf_mregion_rewind() or
  * xf_mregion_destroy() is used to free given memory.)
  *
+ * Allocation is a pointer bump in the current subregion; see
+ * %XF_MREGION_SLACK_REVISIT for what happens to the space left over when
+ * a new subregion is moved on to.
+ *
+ * The returned memory is aligned to @r->align bytes.
+ *
+ * Return:	the memory, %NULL only if a region from
+ *		xf_mregion_create_file() has used up its reservation
  */
 XFFNC void *xf_mregion_alloc(struct xf_mregion *r, size_t size);
 
+/**
+ * xf_mregion_alloc_aligned() - allocate aligned memory from given region
+ * @r:		region to allocate from
+ * @size:	size of the allocation
+ * @align:	alignment of the returned memory, must be a power of two
+ *
+ * Same as xf_mregion_alloc(), except that the returned memory will be
+ * aligned to @align bytes regardless of @r->align. Alignments up to
+ * %XF_MREGION_SUB_ALIGN cost at most @align - 1 bytes of padding, larger
+ * ones (page alignment for instance) may additionally require a subregion
+ * that much larger.
+ */
+XFFNC void *xf_mregion_alloc_aligned(struct xf_mregion *r, size_t size,
+		size_t align);
+
+#if __GNUC__
+/**
+ * xf_mregion_alloc_atomic() - allocate from a region shared between threads
+ * @r:		region to allocate from
+ * @size:	size of the allocation
+ *
+ * Like xf_mregion_alloc(), but safe to be called by any number of threads
+ * concurrently. Memory is claimed from the current subregion with a single
+ * atomic fetch-and-add; when it is exhausted, the threads race to link the
+ * next subregion and the one that loses frees its attempt.
+ *
+ * @size is rounded up to a multiple of @r->align. The tail of a subregion
+ * left unaligned by non-atomic allocations is skipped.
+ *
+ * None of the other functions may run on @r while any thread can be in
+ * this one, the caller has to synchronise before e.g. xf_mregion_rewind().
+ */
+XFFNC void *xf_mregion_alloc_atomic(struct xf_mregion *r, size_t size);
+#endif
+
 /**
  * xf_mregion_undo() - undo the previous allocation
  * @r:		the region that the undesired memory was allocated out of
@@ -127,23 +511,114 @@ XFFNC void *xf_mregion_alloc(struct xf_mregion *r, size_t size);
  */
 XFFNC void xf_mregion_undo(struct xf_mregion *r, void *mem);
 
+/**
+ * xf_mregion_mark() - remember the current allocation position of a region
+ * @r:		region to take the mark from
+ *
+ * Marks can be nested: take one at the beginning of each scope and give it
+ * to xf_mregion_rewind() at its end.
+ *
+ * Return:	mark to be later given to xf_mregion_rewind()
+ */
+XFFNC struct xf_mregion_mark xf_mregion_mark(struct xf_mregion *r);
+
+/**
+ * xf_mregion_rewind() - release everything allocated after a mark
+ * @r:		region the mark was taken from
+ * @m:		the mark as returned by xf_mregion_mark()
+ *
+ * All the memory allocated from @r since @m was taken becomes available
+ * again. Marks taken after @m are invalidated, marks taken before it are
+ * left intact so that nested scopes can rewind in any outward order.
+ *
+ * This takes constant time unless the allocations since @m spilled over to
+ * further subregions, in which case each one of those is reset.
+ *
+ * With %XF_MREGION_SLACK_REVISIT, memory that was placed into the slack of
+ * subregions before the one @m was taken in is not released until
+ * xf_mregion_clear().
+ */
+XFFNC void xf_mregion_rewind(struct xf_mregion *r, struct xf_mregion_mark m);
+
+/**
+ * xf_mregion_realloc_last() - resize the previous allocation
+ * @r:		the region @mem was allocated out of
+ * @mem:	the most recent allocation from @r or %NULL to just allocate
+ * @size:	the new size of @mem
+ *
+ * If the subregion @mem is in has room for @size bytes from @mem on, the
+ * allocation is grown or shrunk in place. Otherwise the space of @mem is
+ * given back, @size bytes are allocated the way xf_mregion_alloc() does it
+ * and the contents of @mem are copied over. That makes this suitable for
+ * building strings and arrays of unknown length at the end of a region.
+ *
+ * Return:	@mem or the new location of its contents; %NULL only if a
+ *		file backed region ran out of space, in which case @mem is
+ *		left as it was
+ */
+XFFNC void *xf_mregion_realloc_last(struct xf_mregion *r, void *mem,
+		size_t size);
+
 /**
  * xf_mregion_clear() - rewind all of the memory to be once again usable
  * @r:		region to clear
  *
  * After this function returns, all the memory regions will be still linked,
  * but marked as available for allocation via xf_mregion_alloc().
+ *
+ * Only the subregions used since the previous clear are touched, unless
+ * @r->keep asks for the region to be trimmed.
  */
 XFFNC void xf_mregion_clear(struct xf_mregion *r);
 
 /**
- * xf_htable_memcnt() - count dynamically allocated memory associated with region
+ * xf_mregion_trim() - give unused memory back to the system
+ * @r:		region to trim
+ * @keep:	how many bytes worth of subregions to hold on to
+ *
+ * Subregions in use are always kept, after those unused subregions are
+ * kept as long as their total size stays within @keep. Of the rest, heap
+ * allocated ones are freed and mmap()'ed ones have their pages released
+ * with madvise(%MADV_DONTNEED), keeping the address range reserved for
+ * when the region grows back. Where %MADV_DONTNEED isn't available, those
+ * are unmapped as well.
+ */
+XFFNC void xf_mregion_trim(struct xf_mregion *r, size_t keep);
+
+/**
+ * xf_mregion_memcnt() - count dynamically allocated memory associated with region
  * @r:		memory region which's memory to examine
  *
- * Return:	amount of memory malloc()'ed
+ * Return:	amount of memory reserved for subregion data, including the
+ *		memory given back to the system by xf_mregion_trim()
  */
 XFFNC size_t xf_mregion_memcnt(struct xf_mregion *r);
 
+/**
+ * xf_mregion_rescnt() - count memory of region that is resident
+ * @r:		memory region which's memory to examine
+ *
+ * Return:	xf_mregion_memcnt() minus the subregions whose pages have been
+ *		given back to the system
+ */
+XFFNC size_t xf_mregion_rescnt(struct xf_mregion *r);
+
+#if XF_MREGION_STATS
+/**
+ * xf_mregion_stats_dump() - format the statistics of a region as one line
+ * @r:		region which's statistics to format
+ * @buf:	where to write the line, '\0' terminated and without '\n'
+ * @n:		size of @buf
+ *
+ * The line consists of space separated "name=value" pairs, the histogram
+ * is a comma separated list of @r->stats.hist.
+ *
+ * Return:	like snprintf(), the length of the whole line even if @n was
+ *		too small to hold it
+ */
+XFFNC int xf_mregion_stats_dump(struct xf_mregion *r, char *buf, size_t n);
+#endif
+
 #if XFSTATIC == 1 // Include function bodies?
 #include "xf-mregion.c"
 #endif
@@ -152,8 +627,12 @@ XFFNC size_t xf_mregion_memcnt(struct xf_mregion *r);
 // Clear up some internal «local» definitions
 #undef XFFNC
 #undef XFNOWRN
+#undef XFALIGN
 #undef XFSTATIC
 #undef XF_MREGION_EXP_ALLOC
+#undef XF_MREGION_SLACK_REVISIT
+#undef XF_MREGION_ALIGN
+#undef XF_MREGION_KEEP
 #endif
 
 #endif
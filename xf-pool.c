@@ -0,0 +1,186 @@
+#if !defined(XFSTATIC) /* is .c processed first? */
+#define _XF_STATIC 0 /* avoid looping between .c and .h */
+#define _XF_MACROS 1
+#include "xf-pool.h"
+#endif
+
+#include <assert.h> // assert
+
+/* size class of objects of @size bytes */
+#define XF_POOL_CLASS(size) (((size) - 1) / XF_POOL_GRAIN)
+
+XFFNC struct xf_pool *xf_pool_construct(struct xf_pool *p)
+{
+	assert(p != NULL);
+	struct xf_mregion_grow g = { 200, XF_POOL_SLAB, 1024 * XF_POOL_SLAB };
+	p->r = xf_mregion_create_grow(XF_POOL_SLAB, &g);
+	p->r->align = XF_POOL_GRAIN;
+	xf_pool_clear(p);
+	p->lock = 0;
+	return p;
+}
+
+XFFNC void xf_pool_destruct(struct xf_pool *p)
+{
+	assert(p != NULL);
+	xf_mregion_destroy(p->r);
+	p->r = NULL;
+}
+
+XFFNC void xf_pool_clear(struct xf_pool *p)
+{
+	int i;
+	xf_mregion_clear(p->r);
+	for (i = 0; i < XF_POOL_CLASSES; i++) {
+		p->cls[i].free = NULL;
+		p->cls[i].cur = NULL;
+		p->cls[i].end = NULL;
+	}
+}
+
+/**
+ * xf_pool_class_get() - take an object of given size class
+ * @p:		pool to take from
+ * @ci:		index of the size class
+ */
+static void *xf_pool_class_get(struct xf_pool *p, unsigned int ci)
+{
+	struct xf_pool_class *c = &p->cls[ci];
+	size_t osz = (ci + 1) * XF_POOL_GRAIN;
+	void *rv = c->free;
+
+	if (rv != NULL) {
+		c->free = *(void **) rv;
+		return rv;
+	}
+	if ((size_t) (c->end - c->cur) < osz) {
+		/* the tail of the previous slab too small, new slab */
+		c->cur = xf_mregion_alloc(p->r, XF_POOL_SLAB);
+		c->end = c->cur + XF_POOL_SLAB;
+	}
+	rv = c->cur;
+	c->cur += osz;
+	return rv;
+}
+
+XFFNC void *xf_pool_alloc(struct xf_pool *p, size_t size)
+{
+	assert(p != NULL);
+	assert(size > 0 && size <= XF_POOL_MAX);
+	return xf_pool_class_get(p, XF_POOL_CLASS(size));
+}
+
+XFFNC void xf_pool_free(struct xf_pool *p, void *mem, size_t size)
+{
+	assert(p != NULL && mem != NULL);
+	assert(size > 0 && size <= XF_POOL_MAX);
+	struct xf_pool_class *c = &p->cls[XF_POOL_CLASS(size)];
+	*(void **) mem = c->free;
+	c->free = mem;
+}
+
+XFFNC size_t xf_pool_memcnt(struct xf_pool *p)
+{
+	assert(p != NULL);
+	return xf_mregion_memcnt(p->r);
+}
+
+#if __GNUC__
+static void xf_pool_lock(struct xf_pool *p)
+{
+	while (__atomic_test_and_set(&p->lock, __ATOMIC_ACQUIRE))
+		;
+}
+
+static void xf_pool_unlock(struct xf_pool *p)
+{
+	__atomic_clear(&p->lock, __ATOMIC_RELEASE);
+}
+
+/**
+ * xf_pool_cache_spill() - give cached objects of a size class back to pool
+ * @c:		cache to take the objects from
+ * @ci:		index of the size class
+ * @n:		how many objects, at most @c->count[@ci]
+ */
+static void xf_pool_cache_spill(struct xf_pool_cache *c, unsigned int ci,
+		unsigned int n)
+{
+	void *first = c->free[ci];
+	void *last = first;
+	unsigned int i;
+
+	if (n == 0)
+		return;
+	for (i = 1; i < n; i++)
+		last = *(void **) last;
+	c->free[ci] = *(void **) last;
+	c->count[ci] -= n;
+
+	/* splice the whole chain in at once */
+	xf_pool_lock(c->p);
+	*(void **) last = c->p->cls[ci].free;
+	c->p->cls[ci].free = first;
+	xf_pool_unlock(c->p);
+}
+
+XFFNC struct xf_pool_cache *xf_pool_cache_construct(struct xf_pool_cache *c,
+		struct xf_pool *p)
+{
+	assert(c != NULL && p != NULL);
+	int i;
+	c->p = p;
+	for (i = 0; i < XF_POOL_CLASSES; i++) {
+		c->free[i] = NULL;
+		c->count[i] = 0;
+	}
+	return c;
+}
+
+XFFNC void xf_pool_cache_destruct(struct xf_pool_cache *c)
+{
+	assert(c != NULL);
+	int i;
+	for (i = 0; i < XF_POOL_CLASSES; i++)
+		xf_pool_cache_spill(c, i, c->count[i]);
+	c->p = NULL;
+}
+
+XFFNC void *xf_pool_cache_alloc(struct xf_pool_cache *c, size_t size)
+{
+	assert(c != NULL);
+	assert(size > 0 && size <= XF_POOL_MAX);
+	unsigned int ci = XF_POOL_CLASS(size);
+	void *rv = c->free[ci];
+
+	if (rv == NULL) {
+		/* refill with a batch, keeping the last one for the caller */
+		unsigned int i;
+		xf_pool_lock(c->p);
+		for (i = 1; i < XF_POOL_CACHE / 2; i++) {
+			void *o = xf_pool_class_get(c->p, ci);
+			*(void **) o = c->free[ci];
+			c->free[ci] = o;
+		}
+		rv = xf_pool_class_get(c->p, ci);
+		xf_pool_unlock(c->p);
+		c->count[ci] = i - 1;
+		return rv;
+	}
+	c->free[ci] = *(void **) rv;
+	c->count[ci]--;
+	return rv;
+}
+
+XFFNC void xf_pool_cache_free(struct xf_pool_cache *c, void *mem, size_t size)
+{
+	assert(c != NULL && mem != NULL);
+	assert(size > 0 && size <= XF_POOL_MAX);
+	unsigned int ci = XF_POOL_CLASS(size);
+
+	*(void **) mem = c->free[ci];
+	c->free[ci] = mem;
+	if (++c->count[ci] > XF_POOL_CACHE)
+		xf_pool_cache_spill(c, ci, XF_POOL_CACHE / 2);
+}
+#endif
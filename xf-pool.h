@@ -0,0 +1,233 @@
+/**
+ * DOC: xf-pool.h
+ * A size-classed object pool on top of xf-mregion.h.
+ *
+ * DOC: README
+ * Objects are sliced out of slabs that are in turn allocated from a region,
+ * freed objects are threaded onto a free list of their size class and handed
+ * out again first. Both allocating and freeing are constant time, and all of
+ * the memory is released at once by destructing the pool.
+ *
+ * Unlike malloc(), xf_pool_free() needs to be told the size of the object,
+ * which is how the pool gets away without a header per object.
+ *
+ * For use from several threads, each thread constructs a &struct
+ * xf_pool_cache of its own for the shared pool and allocates through that.
+ * The cache holds a few objects per size class and only takes the pool's
+ * lock to refill or spill those in batches.
+ *
+ * "xf-bench pool" times a small object churn through the pool, with and
+ * without a cache, against malloc() and free().
+ *
+ * Header version is accessible via %_XF_POOL_H where the three version
+ * numbers are comma-separated.
+ *
+ * To externally share these functions between units (as non-static), define
+ * %_XF_STATIC 0 before including the header and separately compile
+ * xf-pool.c and xf-mregion.c.
+ *
+ * To specify the function declaration flags (static, extern, inline and
+ * whatnot), define %_XF_FNC_DECLR. This defaults to static if %_XF_STATIC is 0,
+ * and no declaration keywords if it is not 0.
+ */
+
+#ifndef _XF_POOL_H
+#define _XF_POOL_H 00,03,00
+
+#include "xf-mregion.h"
+
+/* #define _XF_STATIC 0 to use these as external functions */
+#ifndef _XF_STATIC // Whether library should "#include" function bodies
+#define XFSTATIC 1
+#else
+#define XFSTATIC _XF_STATIC
+#endif
+
+#if __GNUC__ /* Suppress unused warnings */
+#define XFNOWRN __attribute__((unused))
+#else
+#define XFNOWRN
+#endif
+
+#ifdef _XF_FNC_DECLR // The flags embedded in function declaration
+#define XFFNC XFNOWRN _XF_FNC_DECLR
+#elif XFSTATIC == 1
+#define XFFNC XFNOWRN static
+#else
+#define XFFNC XFNOWRN
+#endif
+
+#ifndef XF_POOL_GRAIN
+/**
+ * XF_POOL_GRAIN - size class granularity
+ *
+ * Size classes are multiples of this many bytes, which is also the alignment
+ * of every object. Must be a power of two at least the size of a pointer,
+ * defaults to 16.
+ */
+#define XF_POOL_GRAIN 16
+#endif
+
+#ifndef XF_POOL_CLASSES
+/**
+ * XF_POOL_CLASSES - number of size classes
+ *
+ * The largest object a pool can hand out is %XF_POOL_MAX, which is
+ * %XF_POOL_GRAIN * %XF_POOL_CLASSES. Defaults to 32 (512 byte objects).
+ */
+#define XF_POOL_CLASSES 32
+#endif
+
+#define XF_POOL_MAX (XF_POOL_GRAIN * XF_POOL_CLASSES)
+
+#ifndef XF_POOL_SLAB
+/**
+ * XF_POOL_SLAB - bytes allocated from the region whenever a size class runs
+ * out of objects; defaults to 16 KiB
+ */
+#define XF_POOL_SLAB 16384
+#endif
+
+#ifndef XF_POOL_CACHE
+/**
+ * XF_POOL_CACHE - objects a &struct xf_pool_cache holds per size class
+ *
+ * When a cache runs out of objects of a class it takes half of this many
+ * from the pool, when it would hold more than this it returns half. Defaults
+ * to 64.
+ */
+#define XF_POOL_CACHE 64
+#endif
+
+/**
+ * struct xf_pool_class - state of a single size class
+ * @free:	singly linked list of freed objects, the link is stored in the
+ *		first bytes of each object
+ * @cur:	where to slice the next new object from
+ * @end:	end of the slab @cur is in
+ */
+struct xf_pool_class {
+	void *free;
+	char *cur;
+	char *end;
+};
+
+/**
+ * struct xf_pool - instance of object pool
+ * @r:		region the slabs are allocated from
+ * @cls:	size classes, objects of up to (i + 1) * %XF_POOL_GRAIN bytes
+ *		are in @cls[i]
+ * @lock:	taken by &struct xf_pool_cache functions
+ */
+struct xf_pool {
+	struct xf_mregion *r;
+	struct xf_pool_class cls[XF_POOL_CLASSES];
+	char lock;
+};
+
+/**
+ * struct xf_pool_cache - per-thread front end of &struct xf_pool
+ * @p:		the pool objects come from and go back to
+ * @free:	per size class lists of objects like &struct xf_pool_class.free
+ * @count:	lengths of the lists in @free
+ */
+struct xf_pool_cache {
+	struct xf_pool *p;
+	void *free[XF_POOL_CLASSES];
+	unsigned int count[XF_POOL_CLASSES];
+};
+
+/**
+ * xf_pool_construct() - initialize an instance of struct xf_pool
+ * @p:		instance to initialize
+ *
+ * Return:	@p
+ */
+XFFNC struct xf_pool *xf_pool_construct(struct xf_pool *p);
+
+/**
+ * xf_pool_destruct() - release all of the objects and memory of a pool
+ * @p:		pool no longer required
+ */
+XFFNC void xf_pool_destruct(struct xf_pool *p);
+
+/**
+ * xf_pool_clear() - release all of the objects but keep the memory
+ * @p:		pool to reset
+ */
+XFFNC void xf_pool_clear(struct xf_pool *p);
+
+/**
+ * xf_pool_alloc() - allocate an object
+ * @p:		pool to allocate from
+ * @size:	size of the object, at most %XF_POOL_MAX
+ *
+ * Return:	memory aligned to %XF_POOL_GRAIN bytes
+ */
+XFFNC void *xf_pool_alloc(struct xf_pool *p, size_t size);
+
+/**
+ * xf_pool_free() - return an object to the pool
+ * @p:		pool @mem was allocated from
+ * @mem:	object as returned by xf_pool_alloc()
+ * @size:	the size given to xf_pool_alloc() for @mem
+ */
+XFFNC void xf_pool_free(struct xf_pool *p, void *mem, size_t size);
+
+/**
+ * xf_pool_memcnt() - count memory associated with pool
+ * @p:		pool which's memory to count
+ *
+ * Return:	amount of memory reserved by the region of @p
+ */
+XFFNC size_t xf_pool_memcnt(struct xf_pool *p);
+
+#if __GNUC__
+/**
+ * xf_pool_cache_construct() - initialize a per-thread cache of a pool
+ * @c:		instance to initialize
+ * @p:		pool the cache is for
+ *
+ * Any number of threads can each use a cache of their own for the same
+ * pool at once, but xf_pool_alloc() and xf_pool_free() must not be used on
+ * that pool meanwhile.
+ *
+ * Return:	@c
+ */
+XFFNC struct xf_pool_cache *xf_pool_cache_construct(struct xf_pool_cache *c,
+		struct xf_pool *p);
+
+/**
+ * xf_pool_cache_destruct() - return the cached objects back to the pool
+ * @c:		cache no longer required
+ */
+XFFNC void xf_pool_cache_destruct(struct xf_pool_cache *c);
+
+/**
+ * xf_pool_cache_alloc() - allocate an object through a per-thread cache
+ * @c:		cache of the calling thread
+ * @size:	size of the object, at most %XF_POOL_MAX
+ */
+XFFNC void *xf_pool_cache_alloc(struct xf_pool_cache *c, size_t size);
+
+/**
+ * xf_pool_cache_free() - return an object through a per-thread cache
+ * @c:		cache of the calling thread
+ * @mem:	object allocated from the pool of @c, by any thread
+ * @size:	the size the object was allocated with
+ */
+XFFNC void xf_pool_cache_free(struct xf_pool_cache *c, void *mem, size_t size);
+#endif
+
+#if XFSTATIC == 1 // Include function bodies?
+#include "xf-pool.c"
+#endif
+
+#if !defined(_XF_MACROS) || _XF_MACROS == 0
+// Clear up some internal «local» definitions
+#undef XFFNC
+#undef XFNOWRN
+#undef XFSTATIC
+#endif
+
+#endif